@@ -0,0 +1,105 @@
+/*
+ * Host side check of the code conversions in ffunicode.c
+ *
+ * Built once per DBCS code page. Compares the direct-indexed tables with
+ * the pair tables for every code and checks that DT_U2O_NBLK and
+ * DT_O2U_NBLK match the number of blocks the pair tables need.
+ * Compares ff_wtoupper with the original table walk for every code point.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../ff/ffunicode.c"
+#include "wtupper_ref.c"
+
+#if FF_CODE_PAGE < 900 || !FF_CP_DIRECT
+#error "cvtest needs a DBCS code page and FF_CP_DIRECT"
+#endif
+
+#define PAIRS(tbl)      (sizeof (tbl) / 4)
+
+static int errors;
+
+//first pair of the code, the terminator {0,0} is not a pair
+static WCHAR pairFind(const WCHAR *p, UINT np, WCHAR code) {
+
+    for (; np; np--, p += 2) {
+        if (p[0] != 0 && p[0] == code)return p[1];
+    }
+    return 0;
+}
+
+//level-2 blocks the pair table needs
+static UINT pairBlocks(const WCHAR *p, UINT np) {
+
+    static BYTE used[0x10000 / DT_BLK];
+    UINT nb = 0;
+
+    memset(used, 0, sizeof (used));
+    for (; np; np--, p += 2) {
+        if (p[0] == 0 || used[p[0] / DT_BLK])continue;
+        used[p[0] / DT_BLK] = 1;
+        nb++;
+    }
+    return nb;
+}
+
+static UINT idxMax(const WORD *idx) {
+
+    UINT max = 0;
+
+    for (UINT i = 0; i < 0x10000 / DT_BLK; i++) {
+        if (idx[i] > max)max = idx[i];
+    }
+    return max;
+}
+
+static void blocksCheck(const char *name, const WCHAR *p, UINT np, const WORD *idx, UINT nblk) {
+
+    UINT need = pairBlocks(p, np);
+    UINT used = idxMax(idx);
+
+    printf("  %s: %u blocks, DT_%s_NBLK %u\n", name, need, name, nblk);
+    if (need != nblk || used != nblk) {
+        printf("  %s: block count mismatch, tables need %u, used %u\n", name, need, used);
+        errors++;
+    }
+}
+
+int main() {
+
+    const WCHAR *u2o = CVTBL(uni2oem, FF_CODE_PAGE);
+    const WCHAR *o2u = CVTBL(oem2uni, FF_CODE_PAGE);
+    UINT n_u2o = PAIRS(CVTBL(uni2oem, FF_CODE_PAGE));
+    UINT n_o2u = PAIRS(CVTBL(oem2uni, FF_CODE_PAGE));
+    UINT bad = 0;
+
+    printf("cp%d\n", FF_CODE_PAGE);
+
+    for (DWORD c = 0x80; c < 0x10000; c++) {
+        if (ff_uni2oem(c, FF_CODE_PAGE) != pairFind(u2o, n_u2o, c)) {
+            if (bad++ < 8)printf("  uni2oem %04lX: %04X, pairs %04X\n", (unsigned long) c, ff_uni2oem(c, FF_CODE_PAGE), pairFind(u2o, n_u2o, c));
+        }
+        if (ff_oem2uni(c, FF_CODE_PAGE) != pairFind(o2u, n_o2u, c)) {
+            if (bad++ < 8)printf("  oem2uni %04lX: %04X, pairs %04X\n", (unsigned long) c, ff_oem2uni(c, FF_CODE_PAGE), pairFind(o2u, n_o2u, c));
+        }
+    }
+    printf("  %u conversion mismatches\n", bad);
+    errors += bad != 0;
+
+    blocksCheck("U2O", u2o, n_u2o, dt_u2o_idx, DT_U2O_NBLK);
+    blocksCheck("O2U", o2u, n_o2u, dt_o2u_idx, DT_O2U_NBLK);
+
+    bad = 0;
+    for (DWORD c = 0; c < 0x110000; c++) {
+        if (ff_wtoupper(c) != wtoupperRef(c)) {
+            if (bad++ < 8)printf("  wtoupper %06lX: %06lX, reference %06lX\n", (unsigned long) c, (unsigned long) ff_wtoupper(c), (unsigned long) wtoupperRef(c));
+        }
+    }
+    printf("  wtoupper: %u mismatches over U+0000-U+10FFFF\n", bad);
+    errors += bad != 0;
+
+    printf("  %s\n", errors ? "FAILED" : "OK");
+    return errors != 0;
+}
@@ -0,0 +1,160 @@
+/*-----------------------------------------------------------------------*/
+/* Host side disk I/O module for the FatFs benchmark                     */
+/*-----------------------------------------------------------------------*/
+/* Drive 0 is backed by an image file. Every disk_read/disk_write call   */
+/* is counted as one disk command, the same way diskRead/diskWrite are   */
+/* issued to the SD card on the cartridge.                               */
+/*-----------------------------------------------------------------------*/
+
+#define _FILE_OFFSET_BITS 64
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ff.h"
+#include "diskio.h"
+#include "diskio_file.h"
+
+static int img_fd = -1;
+static LBA_t img_sects;
+DiskStats dstats;
+
+int imgOpen(const char *path, LBA_t sects) {
+
+    imgClose();
+    img_fd = open(path, O_RDWR | O_CREAT | (sects ? O_TRUNC : 0), 0644);
+    if (img_fd < 0)return -1;
+
+    if (sects) {
+        //sparse image, unwritten sectors read as zero
+        if (ftruncate(img_fd, (off_t) sects * 512) != 0)return -1;
+        img_sects = sects;
+    } else {
+        img_sects = (LBA_t) (lseek(img_fd, 0, SEEK_END) / 512);
+    }
+
+    return 0;
+}
+
+void imgClose() {
+
+    if (img_fd >= 0)close(img_fd);
+    img_fd = -1;
+    img_sects = 0;
+}
+
+void statsReset() {
+
+    dstats.rd_cmd = 0;
+    dstats.wr_cmd = 0;
+    dstats.rd_sect = 0;
+    dstats.wr_sect = 0;
+    dstats.sync = 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Get Drive Status                                                      */
+
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status(
+        BYTE pdrv /* Physical drive nmuber to identify the drive */
+        ) {
+
+    if (pdrv != 0 || img_fd < 0)return STA_NOINIT;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Inidialize a Drive                                                    */
+
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize(
+        BYTE pdrv /* Physical drive nmuber to identify the drive */
+        ) {
+
+    return disk_status(pdrv);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read(
+        BYTE pdrv, /* Physical drive nmuber to identify the drive */
+        BYTE *buff, /* Data buffer to store read data */
+        LBA_t sector, /* Start sector in LBA */
+        UINT count /* Number of sectors to read */
+        ) {
+
+    size_t len = (size_t) count * 512;
+
+    if (disk_status(pdrv))return RES_NOTRDY;
+    if (sector + count > img_sects)return RES_PARERR;
+
+    dstats.rd_cmd++;
+    dstats.rd_sect += count;
+    if (pread(img_fd, buff, len, (off_t) sector * 512) != (ssize_t) len)return RES_ERROR;
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_write(
+        BYTE pdrv, /* Physical drive nmuber to identify the drive */
+        const BYTE *buff, /* Data to be written */
+        LBA_t sector, /* Start sector in LBA */
+        UINT count /* Number of sectors to write */
+        ) {
+
+    size_t len = (size_t) count * 512;
+
+    if (disk_status(pdrv))return RES_NOTRDY;
+    if (sector + count > img_sects)return RES_PARERR;
+
+    dstats.wr_cmd++;
+    dstats.wr_sect += count;
+    if (pwrite(img_fd, buff, len, (off_t) sector * 512) != (ssize_t) len)return RES_ERROR;
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_ioctl(
+        BYTE pdrv, /* Physical drive nmuber (0..) */
+        BYTE cmd, /* Control code */
+        void *buff /* Buffer to send/receive control data */
+        ) {
+
+    if (disk_status(pdrv))return RES_NOTRDY;
+
+    switch (cmd) {
+        case CTRL_SYNC:
+            dstats.sync++;
+            return RES_OK;
+
+        case GET_SECTOR_COUNT:
+            *(LBA_t*) buff = img_sects;
+            return RES_OK;
+
+        case GET_SECTOR_SIZE:
+            *(WORD*) buff = 512;
+            return RES_OK;
+
+        case GET_BLOCK_SIZE:
+            //SD erase block of 4MB, used by f_mkfs for data area alignment
+            *(DWORD*) buff = 8192;
+            return RES_OK;
+    }
+
+    return RES_PARERR;
+}
@@ -0,0 +1,24 @@
+/*
+ * File:   diskio_file.h
+ *
+ * Image file backed drive for the host side FatFs benchmark
+ */
+
+#ifndef DISKIO_FILE_H
+#define	DISKIO_FILE_H
+
+typedef struct {
+    unsigned long rd_cmd;
+    unsigned long wr_cmd;
+    unsigned long long rd_sect;
+    unsigned long long wr_sect;
+    unsigned long sync;
+} DiskStats;
+
+extern DiskStats dstats;
+
+int imgOpen(const char *path, LBA_t sects);
+void imgClose();
+void statsReset();
+
+#endif	/* DISKIO_FILE_H */
@@ -0,0 +1,347 @@
+/*
+ * Host side FatFs benchmark
+ *
+ * Builds FAT32 and exFAT images laid out like an ED64 SD card (ROM
+ * collection, fragmented ROMs, huge directory, save files) and measures
+ * disk commands, sectors and wall time of the operations the menu does.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ff.h"
+#include "diskio_file.h"
+
+#define MB              0x100000UL
+#define IMG_SIZE_MB     4096
+#define IMG_MIN_MB      2052 //smallest image with the 65526 clusters of 32K FAT32 needs
+#define ROM_NUM         24
+#define FRAG_ROM_NUM    6
+#define FRAG_PIECE      MB
+#define HUGE_NUM        5000
+#define SAVE_FLA        0x20000
+#define SAVE_SRA        0x8000
+
+static const char *rom_titles[] = {
+    "Super Mario 64 (USA)",
+    "Legend of Zelda, The - Ocarina of Time (USA) (Rev 2)",
+    "Legend of Zelda, The - Majora's Mask (USA)",
+    "GoldenEye 007 (USA)",
+    "Mario Kart 64 (USA)",
+    "Perfect Dark (USA) (Rev 1)",
+    "Banjo-Kazooie (USA) (Rev 1)",
+    "Banjo-Tooie (USA)",
+    "Conker's Bad Fur Day (USA)",
+    "Paper Mario (USA)",
+    "Star Fox 64 (USA) (Rev 1)",
+    "Super Smash Bros. (USA)",
+    "Donkey Kong 64 (USA)",
+    "F-Zero X (USA)",
+    "Wave Race 64 (USA) (Rev 1)",
+    "Pokemon Stadium 2 (USA)",
+    "Resident Evil 2 (USA) (Rev 1)",
+    "Star Wars - Rogue Squadron (USA) (Rev 1)",
+    "Diddy Kong Racing (USA) (En,Fr) (Rev 1)",
+    "1080 Snowboarding (Japan, USA) (En,Ja)",
+    "Kirby 64 - The Crystal Shards (USA)",
+    "Excitebike 64 (USA)",
+    "\x83[\x83\x8B\x83_\x82\xCC\x93`\x90\xE0 \x8E\x9E\x82\xCC\x83I\x83J\x83\x8A\x83i (Japan)",
+    "\x83X\x81[\x83p\x81[\x83}\x83\x8A\x83I64 (Japan)",
+};
+#define TITLE_NUM       (sizeof (rom_titles) / sizeof (rom_titles[0]))
+
+//typical N64 ROM sizes, Mbit / 8
+static const DWORD rom_sizes[] = {8, 12, 16, 32, 8, 16, 64, 4, 32, 40};
+
+static FATFS fs;
+static BYTE work[FF_MAX_SS * 8];
+static BYTE *rom_buf;
+static double op_t0;
+static unsigned long huge_num = HUGE_NUM;
+
+static double timeNow() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void chk(FRESULT res, const char *what, const char *path) {
+
+    if (res == FR_OK)return;
+    fprintf(stderr, "error %d: %s %s\n", res, what, path ? path : "");
+    exit(1);
+}
+
+static void opStart() {
+
+    statsReset();
+    op_t0 = timeNow();
+}
+
+static void opEnd(const char *name) {
+
+    double ms = (timeNow() - op_t0) * 1000;
+
+    printf("  %-26s %8lu %8lu %10llu %10llu %9.3f\n", name,
+            dstats.rd_cmd, dstats.wr_cmd, dstats.rd_sect, dstats.wr_sect, ms);
+}
+
+static void remount() {
+
+    f_mount(0, "", 0);
+    chk(f_mount(&fs, "", 1), "mount", 0);
+}
+
+static DWORD romSize(int idx) {
+
+    return rom_sizes[idx % (sizeof (rom_sizes) / sizeof (rom_sizes[0]))] * MB;
+}
+
+static void romName(char *path, const char *dir, int idx) {
+
+    int ntitles = TITLE_NUM;
+    const char *ext = (idx % 5 == 4) ? "n64" : (idx % 7 == 6) ? "v64" : "z64";
+
+    if (idx < ntitles) {
+        sprintf(path, "%s/%s.%s", dir, rom_titles[idx], ext);
+    } else {
+        sprintf(path, "%s/%s [%d].%s", dir, rom_titles[idx % ntitles], idx / ntitles, ext);
+    }
+}
+
+//allocates the whole file with f_lseek and writes only the header, the data area stays sparse
+static FRESULT makeFile(const char *path, DWORD size) {
+
+    FIL f;
+    UINT bw;
+    BYTE hdr[64];
+    FRESULT res;
+
+    memset(hdr, 0, sizeof (hdr));
+    hdr[0] = 0x80;
+    hdr[1] = 0x37;
+    hdr[2] = 0x12;
+    hdr[3] = 0x40;
+    strncpy((char *) hdr + 0x20, path, 20);
+
+    res = f_open(&f, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (res)return res;
+    res = f_lseek(&f, size);
+    if (res == FR_OK && f_tell(&f) != size)res = FR_DENIED;
+    if (res == FR_OK)res = f_lseek(&f, 0);
+    if (res == FR_OK)res = f_write(&f, hdr, size < sizeof (hdr) ? size : sizeof (hdr), &bw);
+    if (res) {
+        f_close(&f);
+        return res;
+    }
+
+    return f_close(&f);
+}
+
+static void buildCard(BYTE fmt, DWORD au) {
+
+    MKFS_PARM opt = {fmt, 0, 0, 0, au};
+    char path[512];
+    FRESULT res;
+    int i, nfill;
+
+    chk(f_mkfs("", &opt, work, sizeof (work)), "mkfs", 0);
+    chk(f_mount(&fs, "", 1), "mount", 0);
+
+    chk(f_mkdir("ED64"), "mkdir", "ED64");
+    chk(f_mkdir("ED64/gamedata"), "mkdir", "ED64/gamedata");
+    chk(f_mkdir("ED64/tmp"), "mkdir", "ED64/tmp");
+    chk(makeFile("ED64/OS64.v64", MB), "create", "ED64/OS64.v64");
+
+    //contiguous collection, saves for some of the games
+    chk(f_mkdir("ROMs"), "mkdir", "ROMs");
+    for (i = 0; i < ROM_NUM; i++) {
+        romName(path, "ROMs", i);
+        chk(makeFile(path, romSize(i)), "create", path);
+        if (i % 3 == 0) {
+            sprintf(path, "ED64/gamedata/%s.%s", rom_titles[i % TITLE_NUM], i % 2 ? "srm" : "fla");
+            chk(makeFile(path, i % 2 ? SAVE_SRA : SAVE_FLA), "create", path);
+        }
+    }
+
+    //fill the rest of the card and free every other filler, the ROMs written next land in the holes
+    chk(f_mkdir("Fragmented"), "mkdir", "Fragmented");
+    for (nfill = 0;; nfill++) {
+        sprintf(path, "ED64/tmp/fill%04d.bin", nfill);
+        res = makeFile(path, FRAG_PIECE);
+        if (res == FR_DENIED)break;
+        chk(res, "create", path);
+    }
+    chk(f_unlink(path), "unlink", path);
+    for (i = 0; i < nfill; i += 2) {
+        sprintf(path, "ED64/tmp/fill%04d.bin", i);
+        chk(f_unlink(path), "unlink", path);
+    }
+    for (i = 0; i < FRAG_ROM_NUM; i++) {
+        romName(path, "Fragmented", i);
+        chk(makeFile(path, romSize(i)), "create", path);
+    }
+
+    //full set style directory
+    chk(f_mkdir("Huge"), "mkdir", "Huge");
+    for (i = 0; i < huge_num; i++) {
+        sprintf(path, "Huge/%04d - %s.z64", i, rom_titles[i % TITLE_NUM]);
+        chk(makeFile(path, 0), "create", path);
+    }
+
+    f_mount(0, "", 0);
+}
+
+static void listDir(const char *path, const char *name) {
+
+    DIR dir;
+    FILINFO inf;
+    unsigned long n = 0;
+    char label[64];
+
+    opStart();
+    chk(f_opendir(&dir, path), "opendir", path);
+    for (;;) {
+        chk(f_readdir(&dir, &inf), "readdir", path);
+        if (inf.fname[0] == 0)break;
+        n++;
+    }
+    f_closedir(&dir);
+    sprintf(label, "%s (%lu)", name, n);
+    opEnd(label);
+}
+
+//same sequence as fmLoadGame: header, rewind, whole ROM in one f_read
+static void loadRom(const char *path, const char *name) {
+
+    FIL f;
+    UINT br;
+    BYTE hdr[256];
+    DWORD fsize;
+
+    opStart();
+    chk(f_open(&f, path, FA_READ), "open", path);
+    chk(f_read(&f, hdr, sizeof (hdr), &br), "read", path);
+    chk(f_lseek(&f, 0), "seek", path);
+    fsize = f_size(&f);
+    chk(f_read(&f, rom_buf, fsize, &br), "read", path);
+    f_close(&f);
+    opEnd(name);
+}
+
+static void flushSave(const char *path, DWORD size, BYTE mode, const char *name) {
+
+    FIL f;
+    UINT bw;
+
+    memset(rom_buf, 0xA5, size);
+    opStart();
+    chk(f_open(&f, path, FA_WRITE | mode), "open", path);
+    chk(f_write(&f, rom_buf, size, &bw), "write", path);
+    chk(f_close(&f), "close", path);
+    opEnd(name);
+}
+
+static void runSuite(const char *label, BYTE fmt, DWORD au, const char *img, LBA_t sects) {
+
+    FATFS *pfs;
+    DWORD nclst;
+    char path[512];
+    double t;
+
+    if (imgOpen(img, sects) != 0) {
+        fprintf(stderr, "can't create %s\n", img);
+        exit(1);
+    }
+
+    t = timeNow();
+    buildCard(fmt, au);
+    printf("%s, %lu MB image, %lu KB clusters, built in %.2f s\n", label,
+            (unsigned long) (sects / 2048), (unsigned long) (au / 1024), timeNow() - t);
+    printf("  %-26s %8s %8s %10s %10s %9s\n", "operation", "rd cmd", "wr cmd", "rd sect", "wr sect", "ms");
+
+    f_mount(0, "", 0);
+    opStart();
+    chk(f_mount(&fs, "", 1), "mount", 0);
+    opEnd("mount");
+
+    opStart();
+    chk(f_getfree("", &nclst, &pfs), "getfree", 0);
+    opEnd("free space");
+
+    remount();
+    listDir("", "list root");
+    listDir("ROMs", "list ROMs");
+    listDir("Huge", "list Huge");
+    listDir("Huge", "list Huge again");
+
+    remount();
+    romName(path, "ROMs", 6);
+    loadRom(path, "load ROM 64MB");
+    romName(path, "Fragmented", 3);
+    loadRom(path, "load ROM 32MB fragmented");
+    sprintf(path, "Huge/%04lu - %s.z64", huge_num - 1, rom_titles[(huge_num - 1) % TITLE_NUM]);
+    loadRom(path, "open last of Huge");
+    loadRom(path, "open last of Huge again");
+
+    remount();
+    sprintf(path, "ED64/gamedata/%s.fla", rom_titles[0]);
+    flushSave(path, SAVE_FLA, FA_OPEN_EXISTING, "save flush 128K flash");
+    sprintf(path, "ED64/gamedata/%s.srm", rom_titles[1]);
+    flushSave(path, SAVE_SRA, FA_CREATE_ALWAYS, "save flush 32K new SRAM");
+
+    f_mount(0, "", 0);
+    imgClose();
+    printf("\n");
+}
+
+static void usage() {
+
+    printf("usage: ffbench [-s image_mb] [-n huge_dir_files] [-k]\n");
+    printf("  -s  image size, %d to 32768 MB (default %d)\n", IMG_MIN_MB, IMG_SIZE_MB);
+    printf("  -k  keep the images (ffbench_fat32.img, ffbench_exfat.img)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+
+    unsigned long img_mb = IMG_SIZE_MB;
+    int keep = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:k")) != -1) {
+        switch (opt) {
+            case 's':
+                img_mb = strtoul(optarg, 0, 0);
+                break;
+            case 'n':
+                huge_num = strtoul(optarg, 0, 0);
+                break;
+            case 'k':
+                keep = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (img_mb < IMG_MIN_MB || img_mb > 32768 || huge_num == 0)usage();
+
+    rom_buf = malloc(64 * MB);
+    if (!rom_buf)return 1;
+
+    runSuite("FAT32", FM_FAT32, 32768, "ffbench_fat32.img", (LBA_t) img_mb * 2048);
+    runSuite("exFAT", FM_EXFAT, 131072, "ffbench_exfat.img", (LBA_t) img_mb * 2048);
+
+    if (!keep) {
+        unlink("ffbench_fat32.img");
+        unlink("ffbench_exfat.img");
+    }
+
+    free(rom_buf);
+    return 0;
+}
@@ -287,6 +287,17 @@ typedef struct {
 #endif
 
 
+/* Directory lookup cache */
+#if FF_USE_DCACHE != 0
+typedef struct {
+	WORD id;		/* Volume mount ID (0:blank entry) */
+	WORD hash;		/* Hash of the up-cased object name */
+	DWORD clu;		/* Containing directory (0:root) */
+	DWORD ofs;		/* Offset of the entry block in the directory */
+} DCENT;
+#endif
+
+
 /* SBCS up-case tables (\x80-\xFF) */
 #define TBL_CT437  {0x80,0x9A,0x45,0x41,0x8E,0x41,0x8F,0x80,0x45,0x45,0x45,0x49,0x49,0x49,0x8E,0x8F, \
 					0x90,0x92,0x92,0x4F,0x99,0x4F,0x55,0x55,0x59,0x99,0x9A,0x9B,0x9C,0x9D,0x9E,0x9F, \
@@ -468,6 +479,13 @@ static BYTE CurrVol;				/* Current drive */
 static FILESEM Files[FF_FS_LOCK];	/* Open object lock semaphores */
 #endif
 
+#if FF_USE_DCACHE != 0
+static DCENT DirCache[FF_USE_DCACHE];	/* Directory lookup cache */
+#define DC_CLEAR()	mem_set(DirCache, 0, sizeof DirCache)
+#else
+#define DC_CLEAR()
+#endif
+
 #if FF_STR_VOLUME_ID
 #ifdef FF_VOLUME_STRS
 static const char* const VolumeStr[FF_VOLUMES] = {FF_VOLUME_STRS};	/* Pre-defined volume ID */
@@ -1481,6 +1499,7 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
 		}
+		if (clst < fs->scan_clst) fs->scan_free++;	/* Update free cluster scan in progress */
 #if FF_FS_EXFAT || FF_USE_TRIM
 		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 			ecl = nxt;
@@ -1623,6 +1642,7 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	if (res == FR_OK) {			/* Update FSINFO if function succeeded. */
 		fs->last_clst = ncl;
 		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst--;
+		if (ncl < fs->scan_clst) fs->scan_free--;	/* Update free cluster scan in progress */
 		fs->fsi_flag |= 1;
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
@@ -1631,6 +1651,97 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	return ncl;		/* Return new cluster number or error status */
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Count free clusters                                    */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT count_free (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* Filesystem object */
+	DWORD nsect		/* Number of FAT/bitmap sectors to be scanned at most (the scan is resumed at next call) */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD nfree, clst, stat;
+	LBA_t sect;
+	UINT i;
+	FFOBJID obj;
+
+
+	clst = fs->scan_clst; nfree = fs->scan_free;
+	if (clst < 2) {		/* Start a new scan */
+		clst = 2; nfree = 0;
+	}
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries (always at once, the FAT is small) */
+		obj.fs = fs;
+		do {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+			if (stat == 0) nfree++;
+		} while (++clst < fs->n_fatent);
+	} else {
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
+			BYTE bm;
+			UINT b;
+
+			sect = fs->bitbase + (clst - 2) / 8 / SS(fs);	/* Bitmap sector (the scan is resumed at a sector boundary) */
+			i = (clst - 2) / 8 % SS(fs);					/* Offset in the sector */
+			while (clst < fs->n_fatent && nsect) {
+				res = move_window(fs, sect++);
+				if (res != FR_OK) break;
+				nsect--;
+				for ( ; i < SS(fs) && clst < fs->n_fatent; i++) {	/* Counts numbuer of bits with zero in the sector */
+					bm = fs->win[i];
+					if ((bm == 0 || bm == 0xFF) && fs->n_fatent - clst >= 8) {	/* Whole byte in use or free? */
+						if (bm == 0) nfree += 8;
+						clst += 8;
+						continue;
+					}
+					for (b = 8; b && clst < fs->n_fatent; b--, clst++) {
+						if (!(bm & 1)) nfree++;
+						bm >>= 1;
+					}
+				}
+				i = 0;
+			}
+		} else
+#endif
+		{	/* FAT16/32: Scan WORD/DWORD FAT entries */
+			UINT esz = (fs->fs_type == FS_FAT16) ? 2 : 4;	/* Size of an FAT entry */
+
+			sect = fs->fatbase + clst * esz / SS(fs);	/* FAT sector */
+			i = clst * esz % SS(fs);					/* Offset in the sector */
+			while (clst < fs->n_fatent && nsect) {
+				res = move_window(fs, sect++);
+				if (res != FR_OK) break;
+				nsect--;
+				for ( ; i < SS(fs) && clst < fs->n_fatent; i += esz, clst++) {	/* Counts numbuer of entries with zero in the sector */
+					if (esz == 2) {
+						if (ld_word(fs->win + i) == 0) nfree++;
+					} else {
+						if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
+					}
+				}
+				i = 0;
+			}
+		}
+	}
+	if (res == FR_OK) {
+		if (clst >= fs->n_fatent) {	/* Has the scan been completed? */
+			fs->free_clst = nfree;	/* Now free_clst is valid */
+			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+			clst = 0;
+		}
+		fs->scan_clst = clst;		/* Save the scan progress for next call */
+		fs->scan_free = nfree;
+	}
+	return res;
+}
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -2439,8 +2550,10 @@ static FRESULT dir_read (
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT dir_scan (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object with the file name */
+	DWORD ofs,				/* Offset to start the search */
+	int blk					/* 0:Search to end of the directory, 1:Check only the entry block at ofs */
 )
 {
 	FRESULT res;
@@ -2450,7 +2563,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	res = dir_sdi(dp, ofs);			/* Move to the start offset */
 	if (res != FR_OK) return res;
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
@@ -2459,6 +2572,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
 
 		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+			if (blk && dp->blk_ofs != ofs) { res = FR_NO_FILE; break; }	/* Out of the entry block to check? */
 #if FF_MAX_LFN < 255
 			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
 #endif
@@ -2477,6 +2591,11 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
 	do {
+#if FF_USE_LFN
+		if (blk && dp->dptr != ofs && dp->blk_ofs != ofs) { res = FR_NO_FILE; break; }	/* Out of the entry block to check? */
+#else
+		if (blk && dp->dptr != ofs) { res = FR_NO_FILE; break; }
+#endif
 		res = move_window(fs, dp->sect);
 		if (res != FR_OK) break;
 		c = dp->dir[DIR_Name];
@@ -2513,6 +2632,53 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 }
 
 
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+#if FF_USE_DCACHE != 0
+	FRESULT res;
+	DCENT *ce = 0;
+	WORD hash = 0;
+#if FF_USE_LFN
+	const WCHAR *lp = dp->obj.fs->lfnbuf;
+	WCHAR wc;
+#else
+	UINT i;
+#endif
+
+	if (!(dp->fn[NSFLAG] & (NS_NOLFN | NS_DOT))) {	/* Can the location of this name be cached? */
+#if FF_USE_LFN
+		while ((wc = *lp++) != 0) {		/* Hash the up-cased name in the same way as exFAT name hash */
+			wc = (WCHAR)ff_wtoupper(wc);
+			hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (wc & 0xFF);
+			hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (wc >> 8);
+		}
+#else
+		for (i = 0; i < 11; i++) hash = ((hash & 1) ? 0x8000 : 0) + (hash >> 1) + dp->fn[i];
+#endif
+		ce = &DirCache[(hash ^ hash >> 5 ^ hash >> 10 ^ dp->obj.sclust) % FF_USE_DCACHE];	/* Fold the hash, its low bits depend mostly on the tail of the name */
+		if (ce->id == dp->obj.fs->id && ce->hash == hash && ce->clu == dp->obj.sclust) {	/* Is there a cached location? */
+			res = dir_scan(dp, ce->ofs, 1);		/* Check the entry block at the location */
+			if (res != FR_NO_FILE && res != FR_INT_ERR) return res;	/* Found or hard error */
+		}
+	}
+	res = dir_scan(dp, 0, 0);			/* Search the directory from the top */
+	if (res == FR_OK && ce) {			/* Register the location of the found object */
+		ce->id = dp->obj.fs->id; ce->hash = hash; ce->clu = dp->obj.sclust;
+#if FF_USE_LFN
+		ce->ofs = (dp->blk_ofs != 0xFFFFFFFF) ? dp->blk_ofs : dp->dptr;
+#else
+		ce->ofs = dp->dptr;
+#endif
+	}
+	return res;
+#else
+	return dir_scan(dp, 0, 0);
+#endif
+}
+
+
 
 
 #if !FF_FS_READONLY
@@ -3490,6 +3656,7 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 
 #if !FF_FS_READONLY
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Initialize cluster allocation information */
+		fs->scan_clst = 0;
 #endif
 		fmt = FS_EXFAT;			/* FAT sub-type */
 	} else
@@ -3549,6 +3716,7 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #if !FF_FS_READONLY
 		/* Get FSInfo if available */
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Initialize cluster allocation information */
+		fs->scan_clst = 0;
 		fs->fsi_flag = 0x80;
 #if (FF_FS_NOFSINFO & 3) != 3
 		if (fmt == FS_FAT32				/* Allow to update FSInfo only if BPB_FSInfo32 == 1 */
@@ -4689,6 +4857,323 @@ FRESULT f_readdir (
 
 
 
+#if FF_USE_DIRSIG
+/*-----------------------------------------------------------------------*/
+/* Get Signature of Directory Entries                                    */
+/*-----------------------------------------------------------------------*/
+/* The raw entries are summed up without LFN reassembly and code conversion,
+/  so that an application can check whether its cached listing of the
+/  directory is still valid. Timestamps other than the last modified time
+/  are excluded. */
+
+FRESULT f_dirsig (
+	DIR* dp,			/* Pointer to the open directory object */
+	UINT nent,			/* Number of directory entries to be processed in this call */
+	DIRSIG* sig			/* Pointer to the signature accumulated over the calls (zeroed by the caller at start) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	BYTE *d, c;
+	UINT i, skip;
+	DWORD sum;
+
+
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		sum = sig->sum;
+		for ( ; nent && dp->sect; nent--) {
+			res = move_window(fs, dp->sect);
+			if (res != FR_OK) break;
+			d = dp->dir;
+			c = d[DIR_Name];
+			if (c == 0) {				/* Reached to end of table */
+				dp->sect = 0; break;
+			}
+#if FF_FS_EXFAT
+			if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+				if (!(c & 0x80)) c = DDEM;	/* Entry not in use */
+				skip = (c == ET_FILEDIR) ? 0xFFFF0F0C : 0;	/* Checksum, create and access time of file entry */
+			} else
+#endif
+			{							/* On the FAT/FAT32 volume */
+				skip = ((d[DIR_Attr] & AM_MASK) != AM_LFN) ? 0x000FF000 : 0;	/* Create and access time of SFN entry */
+			}
+			if (c != DDEM) {
+				sig->nent++;
+				for (i = 0; i < SZDIRE; i++) {
+					if (!(skip & (1UL << i))) sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + d[i];
+				}
+			}
+			res = dir_next(dp, 0);		/* Next entry (dp->sect is cleared at end of the directory) */
+			if (res == FR_NO_FILE) res = FR_OK;
+			if (res != FR_OK) break;
+		}
+		sig->sum = sum;
+		sig->done = dp->sect ? 0 : 1;
+	}
+	LEAVE_FF(fs, res);
+}
+
+#endif	/* FF_USE_DIRSIG */
+
+
+
+#if FF_USE_ENUM && FF_FS_MINIMIZE <= 1
+/*-----------------------------------------------------------------------*/
+/* Enumerate Directory Items                                             */
+/*-----------------------------------------------------------------------*/
+/* The extension filter is tested on the raw UTF-16 or SFN entry, so that
+/  the name of a rejected file is never converted. Accepted items are
+/  reported with the name cut to FF_ENUM_NAME characters. */
+
+#define ENUM_MAXEXT	8	/* Longest extension tested by the filter */
+
+#if FF_USE_LFN
+static UINT ent_nlen (	/* Length of the LFN in UTF-16 units (0:no LFN) */
+	DIR* dp
+)
+{
+	FATFS *fs = dp->obj.fs;
+	UINT n;
+
+
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		n = fs->dirbuf[XDIR_NumName];
+		return (n <= FF_MAX_LFN) ? n : 0;
+	}
+#endif
+	if (dp->blk_ofs == 0xFFFFFFFF) return 0;	/* SFN only */
+	for (n = 0; fs->lfnbuf[n]; n++) ;
+	return n;
+}
+
+
+static WCHAR ent_wchar (	/* Get an UTF-16 unit of the LFN */
+	DIR* dp,
+	UINT i				/* Index of the unit */
+)
+{
+#if FF_FS_EXFAT
+	if (dp->obj.fs->fs_type == FS_EXFAT) {	/* Name is in the C1 entries of the entry block */
+		return ld_word(dp->obj.fs->dirbuf + SZDIRE * (2 + i / 15) + 2 + i % 15 * 2);
+	}
+#endif
+	return dp->obj.fs->lfnbuf[i];
+}
+#endif
+
+
+static int ext_matching (	/* 0:not matched, 1:matched */
+	DIR* dp,
+	const TCHAR* ext	/* Extensions separated by '|' */
+)
+{
+	WCHAR nx[ENUM_MAXEXT], wc, c;
+	UINT n = 0, i, k;
+	int dot = 0;
+
+
+#if FF_USE_LFN
+	i = ent_nlen(dp);
+	if (i) {			/* Get the extension of the LFN backward */
+		while (i) {
+			wc = ent_wchar(dp, --i);
+			if (wc == '.') { dot = 1; break; }
+			if (n == ENUM_MAXEXT) return 0;
+			nx[n++] = wc;
+		}
+	} else
+#endif
+	{					/* Get the extension of the SFN backward */
+		for (i = 11; i > 8; ) {
+			wc = dp->dir[--i];
+			if (wc != ' ' || n) nx[n++] = wc;
+		}
+		dot = n ? 1 : 0;
+	}
+	if (!dot) return 0;
+
+	for (;;) {			/* Compare it with each extension in the list (ASCII, case-insensitive) */
+		for (i = 0; ext[i] && ext[i] != '|'; i++) ;
+		if (i == n) {
+			for (k = 0; k < n; k++) {
+				wc = nx[n - 1 - k]; c = (WCHAR)ext[k];
+				if (IsLower(wc)) wc -= 0x20;
+				if (IsLower(c)) c -= 0x20;
+				if (wc != c) break;
+			}
+			if (k == n) return 1;
+		}
+		if (!ext[i]) return 0;
+		ext += i + 1;
+	}
+}
+
+
+static UINT get_entname (	/* Returns number of encoding units stored */
+	DIR* dp,
+	TCHAR* buf,			/* Output buffer */
+	UINT len,			/* Size of the buffer (>= 2) */
+	BYTE* trunc			/* Set to 1 if the name did not fit in the buffer */
+)
+{
+	UINT si, di = 0, n, i;
+	TCHAR tmp[4];
+	WCHAR wc;
+#if FF_USE_LFN
+	WCHAR hs = 0;
+	UINT nl;
+	BYTE lcf;
+#endif
+
+
+	*trunc = 0;
+	len--;	/* Room for the terminator */
+#if FF_USE_LFN
+	nl = ent_nlen(dp);
+	for (si = 0; si < nl; si++) {	/* Convert the LFN up to the end of the buffer */
+		wc = ent_wchar(dp, si);
+		if (hs == 0 && IsSurrogate(wc)) {	/* Get low surrogate */
+			hs = wc; continue;
+		}
+		n = put_utf((DWORD)hs << 16 | wc, tmp, 4);
+		if (n == 0) { di = 0; break; }		/* Wrong encoding */
+		if (di + n > len) { *trunc = 1; break; }
+		for (i = 0; i < n; i++) buf[di++] = tmp[i];
+		hs = 0;
+	}
+	if (hs != 0 && !*trunc) di = 0;			/* Broken surrogate pair? */
+	if (di != 0 || *trunc) {
+		buf[di] = 0;
+		return di;
+	}
+#if FF_FS_EXFAT
+	if (dp->obj.fs->fs_type == FS_EXFAT) {	/* exFAT does not have SFN */
+		buf[di++] = '?';	/* Inaccessible object name */
+		buf[di] = 0;
+		return di;
+	}
+#endif
+
+	/* Get the SFN with case information if LFN is not available */
+	lcf = NS_BODY;
+#endif
+	*trunc = 0;
+	for (si = 0; si < 11; ) {
+		wc = dp->dir[si++];
+		if (wc == ' ') continue;		/* Skip padding spaces */
+		if (wc == RDDEM) wc = DDEM;		/* Restore replaced DDEM character */
+		if (si == 9) {					/* Insert a . if extension is exist */
+			if (di == len) { *trunc = 1; break; }
+			buf[di++] = '.';
+#if FF_USE_LFN
+			lcf = NS_EXT;
+#endif
+		}
+#if FF_USE_LFN
+		if (IsUpper(wc) && (dp->dir[DIR_NTres] & lcf)) wc += 0x20;
+#endif
+#if FF_USE_LFN && FF_LFN_UNICODE >= 1	/* Unicode output */
+		if (dbc_1st((BYTE)wc) && si != 8 && si != 11 && dbc_2nd(dp->dir[si])) {	/* Make a DBC if needed */
+			wc = wc << 8 | dp->dir[si++];
+		}
+		wc = ff_oem2uni(wc, CODEPAGE);	/* ANSI/OEM -> Unicode */
+		n = wc ? put_utf(wc, tmp, 4) : 0;
+		if (n == 0) { di = 0; break; }	/* Wrong char in the current code page? */
+#else									/* ANSI/OEM output */
+		tmp[0] = (TCHAR)wc; n = 1;
+#endif
+		if (di + n > len) { *trunc = 1; break; }
+		for (i = 0; i < n; i++) buf[di++] = tmp[i];
+	}
+	if (di == 0) buf[di++] = '?';		/* Inaccessible object name */
+	buf[di] = 0;
+	return di;
+}
+
+
+static void get_entinfo (
+	DIR* dp,
+	ENTINFO* eno
+)
+{
+#if FF_FS_EXFAT
+	BYTE *dirb = dp->obj.fs->dirbuf;
+
+	if (dp->obj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		eno->fattrib = dirb[XDIR_Attr];
+		eno->fsize = (eno->fattrib & AM_DIR) ? 0 : ld_qword(dirb + XDIR_FileSize);
+		eno->ftime = ld_word(dirb + XDIR_ModTime + 0);
+		eno->fdate = ld_word(dirb + XDIR_ModTime + 2);
+	} else
+#endif
+	{										/* On the FAT/FAT32 volume */
+		eno->fattrib = dp->dir[DIR_Attr];
+		eno->fsize = ld_dword(dp->dir + DIR_FileSize);
+		eno->ftime = ld_word(dp->dir + DIR_ModTime + 0);
+		eno->fdate = ld_word(dp->dir + DIR_ModTime + 2);
+	}
+	get_entname(dp, eno->fname, FF_ENUM_NAME + 1, &eno->ftrunc);
+}
+
+
+FRESULT f_enumdir (
+	DIR* dp,			/* Pointer to the open directory object */
+	const TCHAR* ext,	/* Extensions of the files to be reported, "z64|v64" (null:all files). Sub-directories are always reported */
+	UINT* nent,			/* Number of items allowed to process, decreased by the processed items */
+	ENUMFUNC func,		/* Callback function, returns non-zero to stop the enumeration after this item */
+	void* arg			/* Argument passed to the callback function */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	ENTINFO eno;
+	int stop = 0;
+	DEF_NAMBUF
+
+
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		INIT_NAMBUF(fs);
+		while (*nent && dp->sect && !stop) {
+			res = DIR_READ_FILE(dp);		/* Read an item (dp->sect is cleared at end of the directory) */
+			if (res != FR_OK) break;
+			(*nent)--;
+			if (!ext || (dp->obj.attr & AM_DIR) || ext_matching(dp, ext)) {
+				get_entinfo(dp, &eno);
+				stop = func(dp, &eno, arg);	/* The entry stays valid for f_entname() while in the callback */
+			}
+			res = dir_next(dp, 0);			/* Increment index for next */
+			if (res != FR_OK) break;
+		}
+		if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory */
+		FREE_NAMBUF();
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+UINT f_entname (	/* Returns length of the name (0:did not fit in the buffer) */
+	DIR* dp,		/* Directory object passed to the enumeration callback */
+	TCHAR* buf,		/* Buffer to store the full name */
+	UINT len		/* Size of the buffer */
+)
+{
+	BYTE trunc;
+	UINT n;
+
+
+	if (len < 2) return 0;
+	n = get_entname(dp, buf, len, &trunc);
+	return trunc ? 0 : n;
+}
+
+#endif	/* FF_USE_ENUM */
+
+
+
 #if FF_USE_FIND
 /*-----------------------------------------------------------------------*/
 /* Find Next File                                                        */
@@ -4789,10 +5274,6 @@ FRESULT f_getfree (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD nfree, clst, stat;
-	LBA_t sect;
-	UINT i;
-	FFOBJID obj;
 
 
 	/* Get logical drive */
@@ -4800,69 +5281,51 @@ FRESULT f_getfree (
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 		/* If free_clst is valid, return it without full FAT scan */
-		if (fs->free_clst <= fs->n_fatent - 2) {
-			*nclst = fs->free_clst;
-		} else {
-			/* Scan FAT to obtain number of free clusters */
-			nfree = 0;
-			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
-				clst = 2; obj.fs = fs;
-				do {
-					stat = get_fat(&obj, clst);
-					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) nfree++;
-				} while (++clst < fs->n_fatent);
-			} else {
-#if FF_FS_EXFAT
-				if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
-					BYTE bm;
-					UINT b;
-
-					clst = fs->n_fatent - 2;	/* Number of clusters */
-					sect = fs->bitbase;			/* Bitmap sector */
-					i = 0;						/* Offset in the sector */
-					do {	/* Counts numbuer of bits with zero in the bitmap */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
-							if (!(bm & 1)) nfree++;
-							bm >>= 1;
-						}
-						i = (i + 1) % SS(fs);
-					} while (clst);
-				} else
-#endif
-				{	/* FAT16/32: Scan WORD/DWORD FAT entries */
-					clst = fs->n_fatent;	/* Number of entries */
-					sect = fs->fatbase;		/* Top of the FAT */
-					i = 0;					/* Offset in the sector */
-					do {	/* Counts numbuer of entries with zero in the FAT */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
-							i += 2;
-						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
-							i += 4;
-						}
-						i %= SS(fs);
-					} while (--clst);
-				}
+		if (fs->free_clst > fs->n_fatent - 2) {
+			res = count_free(fs, 0xFFFFFFFF);	/* Scan FAT to obtain number of free clusters */
+		}
+		if (res == FR_OK) *nclst = fs->free_clst;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+#if FF_USE_FREESCAN
+/*-----------------------------------------------------------------------*/
+/* Get Number of Free Clusters in Bounded Steps                          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_scanfree (
+	const TCHAR* path,	/* Logical drive number */
+	UINT nsect,			/* Number of FAT/bitmap sectors to be scanned at most in this call */
+	DWORD* nclst,		/* Pointer to a variable to return number of free clusters (0xFFFFFFFF:not counted yet) */
+	FATFS** fatfs		/* Pointer to return pointer to corresponding filesystem object */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		*fatfs = fs;				/* Return ptr to the fs object */
+		if (fs->free_clst > fs->n_fatent - 2) {	/* Continue the scan if free_clst is not valid */
+			res = count_free(fs, nsect);
+			if (res == FR_OK && fs->free_clst <= fs->n_fatent - 2) {
+				res = sync_fs(fs);	/* Scan completed: write back the FSInfo */
 			}
-			*nclst = nfree;			/* Return the free clusters */
-			fs->free_clst = nfree;	/* Now free_clst is valid */
-			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+		}
+		if (res == FR_OK) {
+			*nclst = (fs->free_clst <= fs->n_fatent - 2) ? fs->free_clst : 0xFFFFFFFF;
 		}
 	}
 
 	LEAVE_FF(fs, res);
 }
+#endif	/* FF_USE_FREESCAN */
 
 
 
@@ -4941,6 +5404,7 @@ FRESULT f_unlink (
 		dj.obj.fs = fs;
 		INIT_NAMBUF(fs);
 		res = follow_path(&dj, path);		/* Follow the file path */
+		DC_CLEAR();							/* Invalidate the directory lookup cache */
 		if (FF_FS_RPATH && res == FR_OK && (dj.fn[NSFLAG] & NS_DOT)) {
 			res = FR_INVALID_NAME;			/* Cannot remove dot entry */
 		}
@@ -5032,6 +5496,7 @@ FRESULT f_mkdir (
 		dj.obj.fs = fs;
 		INIT_NAMBUF(fs);
 		res = follow_path(&dj, path);			/* Follow the file path */
+		DC_CLEAR();								/* Invalidate the directory lookup cache */
 		if (res == FR_OK) res = FR_EXIST;		/* Name collision? */
 		if (FF_FS_RPATH && res == FR_NO_FILE && (dj.fn[NSFLAG] & NS_DOT)) {	/* Invalid name? */
 			res = FR_INVALID_NAME;
@@ -5118,6 +5583,7 @@ FRESULT f_rename (
 		djo.obj.fs = fs;
 		INIT_NAMBUF(fs);
 		res = follow_path(&djo, path_old);		/* Check old object */
+		DC_CLEAR();								/* Invalidate the directory lookup cache */
 		if (res == FR_OK && (djo.fn[NSFLAG] & (NS_DOT | NS_NONAME))) res = FR_INVALID_NAME;	/* Check validity of name */
 #if FF_FS_LOCK != 0
 		if (res == FR_OK) {
@@ -5593,6 +6059,9 @@ FRESULT f_expand (
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
 			}
+			if (scl < fs->scan_clst) {	/* Update free cluster scan in progress */
+				fs->scan_free -= (scl + tcl <= fs->scan_clst) ? tcl : fs->scan_clst - scl;
+			}
 		}
 	}
 
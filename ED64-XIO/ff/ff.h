@@ -154,6 +154,8 @@ typedef struct {
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
+	DWORD	scan_clst;		/* Next cluster to be counted by free cluster scan (0:not in progress) */
+	DWORD	scan_free;		/* Number of free clusters counted below scan_clst */
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -259,6 +261,33 @@ typedef struct {
 
 
 
+/* Directory signature structure (DIRSIG) */
+
+typedef struct {
+	DWORD	nent;			/* Number of used directory entries */
+	DWORD	sum;			/* Checksum of the used directory entries */
+	BYTE	done;			/* End of the directory has been reached */
+} DIRSIG;
+
+
+
+#if FF_USE_ENUM
+/* Directory item structure for the enumeration (ENTINFO) */
+
+typedef struct {
+	FSIZE_t	fsize;			/* File size */
+	WORD	fdate;			/* Modified date */
+	WORD	ftime;			/* Modified time */
+	BYTE	fattrib;		/* File attribute */
+	BYTE	ftrunc;			/* The name is longer than fname[] (get it with f_entname) */
+	TCHAR	fname[FF_ENUM_NAME + 1];	/* File name, cut to FF_ENUM_NAME characters */
+} ENTINFO;
+
+typedef int (*ENUMFUNC)(DIR* dp, const ENTINFO* eno, void* arg);	/* Enumeration callback, returns non-zero to stop */
+#endif
+
+
+
 /* Format parameter structure (MKFS_PARM) */
 
 typedef struct {
@@ -311,6 +340,9 @@ FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
+FRESULT f_dirsig (DIR* dp, UINT nent, DIRSIG* sig);				/* Accumulate signature of directory entries in bounded steps */
+FRESULT f_enumdir (DIR* dp, const TCHAR* ext, UINT* nent, ENUMFUNC func, void* arg);	/* Report directory items to a callback in bounded steps */
+UINT f_entname (DIR* dp, TCHAR* buf, UINT len);					/* Get full name of the item being reported to the callback */
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);	/* Find first file */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);							/* Find next file */
 FRESULT f_mkdir (const TCHAR* path);								/* Create a sub directory */
@@ -323,6 +355,7 @@ FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path, UINT nsect, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters in bounded steps */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
@@ -342,6 +375,7 @@ TCHAR* f_gets (TCHAR* buff, int len, FIL* fp);						/* Get a string from the fil
 #define f_size(fp) ((fp)->obj.objsize)
 #define f_rewind(fp) f_lseek((fp), 0)
 #define f_rewinddir(dp) f_readdir((dp), 0)
+#define f_eod(dp) ((dp)->sect == 0)
 #define f_rmdir(path) f_unlink(path)
 #define f_unmount(path) f_mount(0, path, 0)
 
@@ -38,15 +38,32 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
+#define FF_USE_DIRSIG	1
+/* This option switches directory signature function, f_dirsig(). (0:Disable or
+/  1:Enable) It sums up the raw directory entries a given number at a time, so
+/  that the application can validate a cached directory listing in background. */
+
+
+#define FF_USE_ENUM		1
+#define FF_ENUM_NAME	63
+/* This option switches lean directory enumeration functions, f_enumdir() and
+/  f_entname(). (0:Disable or 1:Enable) The items are reported to a callback with
+/  the name cut to FF_ENUM_NAME characters, and the files rejected by the extension
+/  filter are skipped without any name conversion. */
+
+
+#ifndef FF_USE_MKFS
 #define FF_USE_MKFS		0
-/* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
+#endif
+/* This option switches f_mkfs() function. (0:Disable or 1:Enable) The host side
+/  benchmark in bench/ overrides it on the compiler command line. */
 
 
 #define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -68,9 +85,12 @@
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
 
+#ifndef FF_CODE_PAGE
 #define FF_CODE_PAGE	932
+#endif
 /* This option specifies the OEM code page to be used on the target system.
-/  Incorrect code page setting can cause a file open failure.
+/  Incorrect code page setting can cause a file open failure. The conversion
+/  check in bench/ overrides it on the compiler command line.
 /
 /   437 - U.S.
 /   720 - Arabic
@@ -97,6 +117,21 @@
 */
 
 
+#define FF_CP_DIRECT	1
+/* This option switches direct-indexed code conversion for the DBCS code page
+/  (FF_CODE_PAGE >= 900). (0:Disable or 1:Enable)
+/
+/   0: ff_uni2oem() and ff_oem2uni() do a binary search on the pair tables.
+/   1: Two-level tables are built from the pair tables at first use and each
+/      conversion is done with two table reads. This needs additional BSS of
+/      65K bytes at CP932 (up to 112K bytes at other DBCS code pages).
+/
+/  Every character of the long file name is converted in f_readdir() and path
+/  name parsing, so this option speeds up the directory operations. When file
+/  names with DBCS characters are not needed, an SBCS code page (e.g. 437)
+/  removes the DBCS tables (58K bytes at CP932) and gives the smallest code. */
+
+
 #define FF_USE_LFN		1
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
@@ -260,6 +295,14 @@
 */
 
 
+#define FF_USE_FREESCAN	1
+/* This option switches incremental free cluster scan function, f_scanfree().
+/  (0:Disable or 1:Enable) When the free cluster count is not known after mount,
+/  f_scanfree() counts it a given number of FAT/bitmap sectors at a time so that
+/  the application can spread the scan over idle time. On the FAT32 volume, the
+/  result is written back to the FSINFO sector when the scan is completed. */
+
+
 #define FF_FS_LOCK		0
 /* The option FF_FS_LOCK switches file lock function to control duplicated file open
 /  and illegal operation to open objects. This option must be 0 when FF_FS_READONLY
@@ -272,6 +315,15 @@
 /      lock control is independent of re-entrancy. */
 
 
+#define FF_USE_DCACHE	32
+/* This option sets the number of entries in the directory lookup cache. (0:Disable)
+/  Each entry remembers where a name was found in its parent directory, so that
+/  a repeated path lookup reads only the sectors of that entry block instead of
+/  scanning the directory from the top. A cached location is always verified
+/  against the directory entry, and the cache is cleared by f_unlink(), f_rename()
+/  and f_mkdir(). Each entry takes 12 bytes of work area. */
+
+
 /* #include <somertos.h>	// O/S definitions */
 #define FF_FS_REENTRANT	0
 #define FF_FS_TIMEOUT	1000
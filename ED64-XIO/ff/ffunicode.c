@@ -15272,14 +15272,79 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 /*------------------------------------------------------------------------*/
 
 #if FF_CODE_PAGE >= 900
+#if FF_CP_DIRECT
+/* Direct-indexed two-level conversion tables. The level-1 table maps upper bits
+/  of the code to a level-2 block and the block holds the converted codes. The
+/  tables are built from the pair tables at first use. Block 0 is an empty block
+/  shared by all codes without a conversion. The number of blocks of each table
+/  is checked by bench/cvtest.c. */
+
+#define DT_BLK	64		/* Number of codes in a level-2 block */
+
+#if FF_CODE_PAGE == 932
+#define DT_U2O_NBLK	361	/* Number of level-2 blocks needed by each table */
+#define DT_O2U_NBLK	125
+#elif FF_CODE_PAGE == 936
+#define DT_U2O_NBLK	374
+#define DT_O2U_NBLK	358
+#elif FF_CODE_PAGE == 949
+#define DT_U2O_NBLK	544
+#define DT_O2U_NBLK	315
+#elif FF_CODE_PAGE == 950
+#define DT_U2O_NBLK	352
+#define DT_O2U_NBLK	259
+#endif
+
+static WORD dt_u2o_idx[0x10000 / DT_BLK];	/* Level-1 tables */
+static WORD dt_o2u_idx[0x10000 / DT_BLK];
+static WCHAR dt_u2o_blk[(DT_U2O_NBLK + 1) * DT_BLK];	/* Level-2 blocks */
+static WCHAR dt_o2u_blk[(DT_O2U_NBLK + 1) * DT_BLK];
+static BYTE dt_ready;
+
+
+static void dt_fill (
+	const WCHAR* p,	/* Pair table */
+	UINT np,		/* Number of pairs */
+	WORD* idx,		/* Level-1 table to be filled */
+	WCHAR* blk,		/* Level-2 blocks to be filled */
+	UINT nblk		/* Number of level-2 blocks in blk, block 0 excluded */
+)
+{
+	UINT nb = 1;
+
+
+	for ( ; np; np--, p += 2) {
+		if (p[0] == 0) continue;	/* Skip the table terminator */
+		if (idx[p[0] / DT_BLK] == 0) {	/* Assign a block at first code in it */
+			if (nb > nblk) continue;	/* Out of blocks (wrong DT_*_NBLK), the code is left without conversion */
+			idx[p[0] / DT_BLK] = (WORD)nb++;
+		}
+		if (blk[idx[p[0] / DT_BLK] * DT_BLK + p[0] % DT_BLK] == 0) {	/* Take the first pair if the code has two or more */
+			blk[idx[p[0] / DT_BLK] * DT_BLK + p[0] % DT_BLK] = p[1];
+		}
+	}
+}
+
+
+static void dt_init (void)
+{
+	dt_fill(CVTBL(uni2oem, FF_CODE_PAGE), sizeof CVTBL(uni2oem, FF_CODE_PAGE) / 4, dt_u2o_idx, dt_u2o_blk, DT_U2O_NBLK);
+	dt_fill(CVTBL(oem2uni, FF_CODE_PAGE), sizeof CVTBL(oem2uni, FF_CODE_PAGE) / 4, dt_o2u_idx, dt_o2u_blk, DT_O2U_NBLK);
+	dt_ready = 1;
+}
+#endif
+
+
 WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 	DWORD	uni,	/* UTF-16 encoded character to be converted */
 	WORD	cp		/* Code page for the conversion */
 )
 {
-	const WCHAR *p;
 	WCHAR c = 0, uc;
+#if !FF_CP_DIRECT
+	const WCHAR *p;
 	UINT i = 0, n, li, hi;
+#endif
 
 
 	if (uni < 0x80) {	/* ASCII? */
@@ -15288,6 +15353,10 @@ WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 	} else {			/* Non-ASCII */
 		if (uni < 0x10000 && cp == FF_CODE_PAGE) {	/* Is it in BMP and valid code page? */
 			uc = (WCHAR)uni;
+#if FF_CP_DIRECT
+			if (!dt_ready) dt_init();
+			c = dt_u2o_blk[dt_u2o_idx[uc / DT_BLK] * DT_BLK + uc % DT_BLK];
+#else
 			p = CVTBL(uni2oem, FF_CODE_PAGE);
 			hi = sizeof CVTBL(uni2oem, FF_CODE_PAGE) / 4 - 1;
 			li = 0;
@@ -15301,6 +15370,7 @@ WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 				}
 			}
 			if (n != 0) c = p[i * 2 + 1];
+#endif
 		}
 	}
 
@@ -15313,9 +15383,11 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 	WORD	cp		/* Code page for the conversion */
 )
 {
-	const WCHAR *p;
 	WCHAR c = 0;
+#if !FF_CP_DIRECT
+	const WCHAR *p;
 	UINT i = 0, n, li, hi;
+#endif
 
 
 	if (oem < 0x80) {	/* ASCII? */
@@ -15323,6 +15395,10 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 
 	} else {			/* Extended char */
 		if (cp == FF_CODE_PAGE) {	/* Is it valid code page? */
+#if FF_CP_DIRECT
+			if (!dt_ready) dt_init();
+			c = dt_o2u_blk[dt_o2u_idx[oem / DT_BLK] * DT_BLK + oem % DT_BLK];
+#else
 			p = CVTBL(oem2uni, FF_CODE_PAGE);
 			hi = sizeof CVTBL(oem2uni, FF_CODE_PAGE) / 4 - 1;
 			li = 0;
@@ -15336,6 +15412,7 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 				}
 			}
 			if (n != 0) c = p[i * 2 + 1];
+#endif
 		}
 	}
 
@@ -15461,12 +15538,36 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 /* Unicode up-case conversion                                             */
 /*------------------------------------------------------------------------*/
 
+static void uc_page_fill (	/* Create index of the conversion table by 256-char page */
+	const WORD* tbl,	/* Compressed up conversion table */
+	UINT pg,			/* First page covered by the table */
+	UINT pe,			/* End of pages covered by the table */
+	WORD* idx			/* Index to be filled (offset of the block to start search in the page) */
+)
+{
+	UINT i = 0, j;
+
+
+	for ( ; pg < pe; pg++) {
+		for (;;) {	/* Find the last block starting at or before top of the page */
+			if (tbl[i] == 0) break;
+			j = i + 2 + ((tbl[i + 1] >> 8) == 0 ? (tbl[i + 1] & 0xFF) : 0);	/* Next block */
+			if (tbl[j] == 0 || tbl[j] > pg << 8) break;
+			i = j;
+		}
+		idx[pg] = (WORD)i;
+	}
+}
+
+
 DWORD ff_wtoupper (	/* Returns up-converted code point */
 	DWORD uni		/* Unicode code point to be up-converted */
 )
 {
 	const WORD *p;
 	WORD uc, bc, nc, cmd;
+	static WORD uc_page[256];	/* Offset of search start in the table by page (valid when uc_ready) */
+	static BYTE uc_ready;
 	static const WORD cvt1[] = {	/* Compressed up conversion table for U+0000 - U+0FFF */
 		/* Basic Latin */
 		0x0061,0x031A,
@@ -15560,9 +15661,23 @@ DWORD ff_wtoupper (	/* Returns up-converted code point */
 	};
 
 
+	if (uni < 0x100) {		/* Basic Latin and Latin-1 Supplement without table search */
+		if ((uni >= 0x61 && uni <= 0x7A) || (uni >= 0xE0 && uni <= 0xFE && uni != 0xF7)) {
+			uni -= 0x20;
+		} else if (uni == 0xFF) {
+			uni = 0x178;
+		}
+		return uni;
+	}
+
 	if (uni < 0x10000) {	/* Is it in BMP? */
+		if (!uc_ready) {	/* Create the page index at first use */
+			uc_page_fill(cvt1, 0x00, 0x10, uc_page);
+			uc_page_fill(cvt2, 0x10, 0x100, uc_page);
+			uc_ready = 1;
+		}
 		uc = (WORD)uni;
-		p = uc < 0x1000 ? cvt1 : cvt2;
+		p = (uc < 0x1000 ? cvt1 : cvt2) + uc_page[uc >> 8];	/* Start search at the page */
 		for (;;) {
 			bc = *p++;								/* Get the block base */
 			if (bc == 0 || uc < bc) break;			/* Not matched? */
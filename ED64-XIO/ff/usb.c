@@ -1,9 +1,114 @@
 
 #include "everdrive.h"
 
+#define USB_PROTO_VER   2
+#define USB_CHUNK       0x10000 //crc32 is checked per chunk
+#define USB_WIN_CHUNKS  64 //chunks in a framed write window, 4MB
+#define USB_DONE_WORDS  (BI_SIZE_ROM / USB_CHUNK / 32)
+
+//capabilities reported by 'v'
+#define USB_CAP_CRC     0x0001 //framed write 'X' with crc32 per chunk
+#define USB_CAP_RESUME  0x0002 //'q' reports rom chunks already received
+#define USB_CAP_LZ      0x0004 //compressed write 'Z'
+#define USB_CAP_HASH    0x0008 //rom chunk hashes 'h', upload record 'H'
+#define USB_CAP_RAM     0x0010 //ram write 'w'. the only write usbService serves
+#define USB_CAP_FILE    0x0020 //sd card file write 'F'
+
+#define USB_ERR_ARG     0x02
+
+#define USB_WR_ICACHE   0x01 //'w' flag, invalidate the instruction cache over the written range
+
+#define USB_LZ_STORED   0x80000000 //chunk frame holds raw data
+#define USB_LZ_STEP     0x1000 //bytes decoded while the next block is received
+#define USB_LZ_FRAME    (USB_CHUNK + 512) //largest chunk frame
+#define USB_DRAIN_MS    100 //the host sent the whole command when nothing arrives for this long
+
+#define USB_FILE_RING   (USB_CHUNK / 512) //blocks of the file write ring, it is usb_lz_out
+#define USB_FILE_STEP   32 //blocks per f_write
+
+#define USB_LOG_SIZE    0x4000 //debug log ring, a power of 2
+#define USB_LOG_BLOCK   (512 - 16) //log text per frame, one fpga buffer with the header
+
+#define USB_REC_ADDR    (SAVE_STAGE_ADDR - 0x200) //upload record, below the save staging area
+#define USB_REC_MAGIC   0x45445531 //"EDU1"
+
+//chunk of a compressed write which is decoded to ROM
+typedef struct {
+    u8 *src;
+    u8 *src_end;
+    u32 addr;
+    u32 len; //decoded length, 0 if there is nothing to decode
+    u32 pos; //bytes decoded
+    u32 wr; //bytes written to ROM
+    u32 crc;
+    u32 crc_ref;
+    u8 stored;
+    u8 err;
+} UsbLz;
+
+//file write to the sd card. blocks are received into the ring while f_write waits for the card
+typedef struct {
+    u32 size;
+    u32 blocks; //512 byte blocks of the file
+    u32 rx; //blocks received
+    u32 wr; //blocks written to the file
+    u32 crc;
+    u8 err; //usb error, the rest of the data is not received
+} UsbFile;
+
+//last upload of the host. kept over reset, the host skips the hash query if it has the same id
+typedef struct {
+    u32 magic;
+    u32 id;
+    u32 addr;
+    u32 len;
+    u32 hash; //sampled hash of the rom memory
+    u32 sum; //sum of the fields above
+    u32 rsv[2];
+} UsbRecord;
+
 u8 usbResp(u8 resp);
+u8 usbRespData(u8 resp, u32 val1, u32 val2);
 void usbCmdCmemFill(u8 *cmd);
 u8 usbCmdRomWR(u8 *cmd);
+u8 usbCmdVersion(u32 caps);
+u8 usbCmdRamWR(u8 *cmd);
+u8 usbCmdRomWRX(u8 *cmd);
+u8 usbCmdQuery(u8 *cmd);
+u8 usbCmdRomWRZ(u8 *cmd);
+void usbChunkEnd(u32 addr, u32 chunk, u8 ok, u32 *bad);
+void usbLzStep(UsbLz *lz, u32 step);
+u8 usbLzDecode(u8 **src_ptr, u8 *src_end, u8 *out, u32 *pos_ptr, u32 end, u32 len);
+u32 usbLzLen(u8 **src, u8 *src_end, u32 len);
+u8 usbCmdRomRD(u8 *cmd);
+u8 usbCmdRamRD(u8 *cmd);
+u8 usbStream(u32 addr, u32 len, void (*rd)(void *, u32));
+void usbRomBlock(void *dst, u32 addr);
+void usbMemBlock(void *dst, u32 addr);
+void usbRegBlock(void *dst, u32 addr);
+u8 usbRegValid(u32 addr);
+u8 usbCmdHash(u8 *cmd);
+u8 usbCmdRecord(u8 *cmd);
+u32 usbRecSum(UsbRecord *rec);
+u32 usbCrc32(u32 crc, u8 *src, u32 len);
+u8 usbLogBlock();
+u8 usbCmdFileWR(u8 *cmd);
+void usbFileTask();
+void usbXferStart(u32 id, u32 addr, u32 len);
+void usbRomDirty(u32 addr, u32 len);
+void usbDrain();
+
+u32 usb_crc_tab[256];
+u32 usb_xfer_id; //framed transfer which usb_done belongs to
+u32 usb_done[USB_DONE_WORDS]; //rom chunks received with good crc
+u64 usb_lz_in[2][USB_LZ_FRAME / 8]; //frame being received and frame being decoded
+u64 usb_lz_out[USB_CHUNK / 8];
+u8 usb_log[USB_LOG_SIZE];
+u32 usb_log_wr; //bytes written to the log, the ring index is the low bits
+u32 usb_log_rd; //bytes sent to the host
+u32 usb_log_drop; //bytes of messages which did not fit
+u64 usb_log_blk[512 / 8];
+UsbFile usb_file;
 
 void usbTerminal() {
 
@@ -51,12 +156,15 @@ void usbLoadGame() {
     gConsPrint("Press B to exit");
     gRepaint();
 
+    //the screen does not change here, there is no repaint. usb is polled all the time and the
+    //controller once per frame, so a command is served as soon as it arrives, not on the next vsync
     while (1) {
 
-        gVsync();
-        controller_scan();
-        cd = get_keys_down();
-        if (cd.c[0].B)return;
+        if (gVsyncPoll()) {
+            controller_scan();
+            cd = get_keys_down();
+            if (cd.c[0].B)return;
+        }
 
         if (!bi_usb_can_rd())continue;
 
@@ -75,6 +183,36 @@ void usbLoadGame() {
             usbResp(0);
         }
 
+        //protocol version and capabilities. legacy hosts never send it
+        if (usb_cmd == 'v') {
+            usbCmdVersion(USB_CAP_CRC | USB_CAP_RESUME | USB_CAP_LZ | USB_CAP_HASH | USB_CAP_RAM | USB_CAP_FILE);
+        }
+
+        //write to ROM memory in crc checked windows
+        if (usb_cmd == 'X') {
+            usbCmdRomWRX(cmd);
+        }
+
+        //write to ROM memory in compressed windows
+        if (usb_cmd == 'Z') {
+            usbCmdRomWRZ(cmd);
+        }
+
+        //hashes of ROM chunks, the host sends only chunks which differ
+        if (usb_cmd == 'h') {
+            usbCmdHash(cmd);
+        }
+
+        //record of the finished upload
+        if (usb_cmd == 'H') {
+            usbCmdRecord(cmd);
+        }
+
+        //chunks of the framed transfer which are already in ROM
+        if (usb_cmd == 'q') {
+            usbCmdQuery(cmd);
+        }
+
         //start the game
         if (usb_cmd == 's') {
             bi_game_cfg_set(SAVE_EEP16K); //set save type
@@ -91,8 +229,125 @@ void usbLoadGame() {
             usbCmdRomWR(cmd);
         }
 
+        //read from ROM memory
+        if (usb_cmd == 'R') {
+            usbCmdRomRD(cmd);
+        }
+
+        //read from RAM or registers
+        if (usb_cmd == 'r') {
+            usbCmdRamRD(cmd);
+        }
+
+        //write to RAM
+        if (usb_cmd == 'w') {
+            usbCmdRamWR(cmd);
+        }
+
+        //write a file to the sd card
+        if (usb_cmd == 'F') {
+            usbCmdFileWR(cmd);
+        }
+
+    }
+
+}
+
+//resident service for programs built with this code. call it once per frame, it returns
+//at once if the host sent nothing. sends the debug log, serves test, version and RAM read and
+//write, so the host can patch code and data without a reboot. patched code must not be running
+//during the call
+void usbService() {
+
+    u8 cmd[16];
+
+    usbLogFlush();
+
+    if (!bi_usb_can_rd())return;
+    if (bi_usb_rd(cmd, 16))return;
+
+    if (cmd[0] != 'c')return;
+    if (cmd[1] != 'm')return;
+    if (cmd[2] != 'd')return;
+
+    if (cmd[3] == 't')usbResp(0);
+    if (cmd[3] == 'v')usbCmdVersion(USB_CAP_RAM);
+    if (cmd[3] == 'r')usbCmdRamRD(cmd);
+    if (cmd[3] == 'w')usbCmdRamWR(cmd);
+}
+
+//debug log. text is only copied to the ring here, usbLogFlush sends it. a message which
+//does not fit is dropped whole and counted. not safe to call from interrupts
+void usbLogString(u8 *str) {
+
+    u32 len = 0;
+
+    while (str[len] != 0)len++;
+
+    if (len > USB_LOG_SIZE - (usb_log_wr - usb_log_rd)) {
+        usb_log_drop += len;
+        return;
     }
 
+    while (len--) {
+        usb_log[usb_log_wr++ & (USB_LOG_SIZE - 1)] = *str++;
+    }
+}
+
+void usbLogHex32(u32 val) {
+
+    u8 buff[8 + 1];
+    u8 i;
+
+    for (i = 0; i < 8; i++) {
+        buff[i] = "0123456789ABCDEF"[(val >> (28 - i * 4)) & 15];
+    }
+    buff[8] = 0;
+
+    usbLogString(buff);
+}
+
+//sends the log in 512 byte fpga buffers while the host takes data. returns at once
+//if the log is empty or nobody reads the port. call it once per frame
+void usbLogFlush() {
+
+    while (usb_log_rd != usb_log_wr) {
+
+        if (!bi_usb_can_wr())return;
+        if (usbLogBlock())return;
+    }
+}
+
+//frame: 'cmdl', 16 byte header with the text length in bytes 8-11 and the dropped bytes
+//in 12-15, then the text padded to a multiple of 4
+u8 usbLogBlock() {
+
+    u8 *buff = (u8 *) usb_log_blk;
+    u32 len = usb_log_wr - usb_log_rd;
+    u32 i;
+    u8 resp;
+
+    if (len > USB_LOG_BLOCK)len = USB_LOG_BLOCK;
+
+    memset(buff, 0, 16);
+    buff[0] = 'c';
+    buff[1] = 'm';
+    buff[2] = 'd';
+    buff[3] = 'l';
+    buff[5] = USB_PROTO_VER;
+    *(u32 *) & buff[8] = len;
+    *(u32 *) & buff[12] = usb_log_drop;
+
+    for (i = 0; i < len; i++) {
+        buff[16 + i] = usb_log[(usb_log_rd + i) & (USB_LOG_SIZE - 1)];
+    }
+    for (; (i & 3) != 0; i++)buff[16 + i] = 0;
+
+    resp = bi_usb_wr(buff, 16 + i);
+    if (resp)return resp;
+
+    usb_log_rd += len;
+    return 0;
 }
 
 u8 usbResp(u8 resp) {
@@ -106,6 +361,23 @@ u8 usbResp(u8 resp) {
     return bi_usb_wr(buff, sizeof (buff));
 }
 
+//response with two 32-bit values in bytes 8-15
+u8 usbRespData(u8 resp, u32 val1, u32 val2) {
+
+    u8 buff[16];
+
+    memset(buff, 0, sizeof (buff));
+    buff[0] = 'c';
+    buff[1] = 'm';
+    buff[2] = 'd';
+    buff[3] = 'r';
+    buff[4] = resp;
+    buff[5] = USB_PROTO_VER;
+    *(u32 *) & buff[8] = val1;
+    *(u32 *) & buff[12] = val2;
+    return bi_usb_wr(buff, sizeof (buff));
+}
+
 void usbCmdCmemFill(u8 *cmd) {
 
     u16 i;
@@ -118,6 +390,9 @@ void usbCmdCmemFill(u8 *cmd) {
         buff[i] = val;
     }
 
+    usbRomDirty(addr, slen * 512);
+    usbXferReset();
+
     while (slen--) {
         sysPI_wr(buff, addr, 512);
         addr += 512;
@@ -133,6 +408,8 @@ u8 usbCmdRomWR(u8 *cmd) {
 
     if (slen == 0)return 0;
 
+    usbRomDirty(addr, slen * 512);
+    usbXferReset();
     bi_usb_rd_start(); //begin first block receiving (512B)
 
     while (slen--) {
@@ -145,4 +422,622 @@ u8 usbCmdRomWR(u8 *cmd) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+//read-backs have no response, the host reads the requested length
+u8 usbCmdRomRD(u8 *cmd) {
+
+    u32 addr = *(u32 *) & cmd[4];
+    u32 slen = *(u32 *) & cmd[8];
+
+    return usbStream(addr, slen * 512, usbRomBlock);
+}
+
+//RDRAM goes to the FIFO by DMA, dirty cache lines are written back first.
+//uncached register windows are read by the CPU in words
+u8 usbCmdRamRD(u8 *cmd) {
+
+    u8 resp;
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8] * 512;
+    u8 rdram = addr >= 0x80000000 && addr < 0xC0000000 && (addr & 0x1FFFFFFF) + len <= 0x800000;
+
+    if (rdram && (addr & 7) == 0) {
+        return bi_usb_wr((void *) ((addr & 0x1FFFFFFF) | 0x80000000), len);
+    }
+
+    if (rdram) {
+        return usbStream(addr, len, usbMemBlock);
+    }
+
+    if (addr >= 0xA0000000 && addr < 0xC0000000 && (addr & 3) == 0 && usbRegValid(addr)) {
+        return usbStream(addr, len, usbRegBlock);
+    }
+
+    //other address, zeros keep the host in sync
+    memset(usb_lz_out, 0, 512);
+    for (u32 pos = 0; pos < len; pos += 512) {
+        resp = bi_usb_wr(usb_lz_out, 512);
+        if (resp)return resp;
+    }
+
+    return USB_ERR_ARG;
+}
+
+//the next block is read while the previous one is being transmitted
+u8 usbStream(u32 addr, u32 len, void (*rd)(void *, u32)) {
+
+    u8 resp;
+    u8 *buff = (u8 *) usb_lz_out;
+
+    if (len == 0)return 0;
+
+    rd(buff, addr);
+
+    for (u32 pos = 0; pos < len; pos += 512) {
+
+        bi_usb_wr_start(&buff[pos & 512]);
+        if (pos + 512 < len)rd(&buff[(pos + 512) & 512], addr + pos + 512);
+        resp = bi_usb_wr_end();
+        if (resp)return resp;
+    }
+
+    return 0;
+}
+
+void usbRomBlock(void *dst, u32 addr) {
+    sysPI_rd(dst, addr, 512);
+}
+
+void usbMemBlock(void *dst, u32 addr) {
+    memcpy(dst, (void *) addr, 512);
+}
+
+//words past the end of the window read as zero
+void usbRegBlock(void *dst, u32 addr) {
+
+    u32 *ptr = (u32 *) dst;
+
+    for (u32 i = 0; i < 512 / 4; i++) {
+        ptr[i] = usbRegValid(addr + i * 4) ? *(vu32 *) (addr + i * 4) : 0;
+    }
+}
+
+//register windows which can be read without side effects. SP_SEMAPHORE is left out,
+//reading it takes the semaphore
+u8 usbRegValid(u32 addr) {
+
+    addr &= 0x1FFFFFFF;
+
+    if (addr >= 0x04000000 && addr < 0x04002000)return 1; //SP DMEM and IMEM
+    if (addr >= 0x04040000 && addr < 0x0404001C)return 1; //SP
+    if (addr >= 0x04080000 && addr < 0x04080008)return 1; //SP PC and IBIST
+    if (addr >= 0x04100000 && addr < 0x04100020)return 1; //DP command
+    if (addr >= 0x04300000 && addr < 0x04300010)return 1; //MI
+    if (addr >= 0x04400000 && addr < 0x04400038)return 1; //VI
+    if (addr >= 0x04500000 && addr < 0x04500018)return 1; //AI
+    if (addr >= 0x04600000 && addr < 0x04600034)return 1; //PI
+    if (addr >= 0x04800000 && addr < 0x0480001C)return 1; //SI
+    if (addr >= 0x1F800000 && addr < 0x1F800020)return 1; //cart config, REG_BASE in bios.c
+    if (addr >= 0x1F808000 && addr < 0x1F808020)return 1; //cart system and game config
+
+    return 0;
+}
+
+u8 usbCmdVersion(u32 caps) {
+
+    return usbRespData(0, caps, USB_CHUNK * USB_WIN_CHUNKS);
+}
+
+//ram write, length in bytes and a multiple of 4. aligned RDRAM is written by DMA straight from
+//the FIFO, sysPI_rd writes back and invalidates the data cache over the block first.
+//unaligned data is copied through the cache and written back
+u8 usbCmdRamWR(u8 *cmd) {
+
+    u8 resp;
+    u8 *buff = (u8 *) usb_lz_out;
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8];
+    u32 flags = *(u32 *) & cmd[12];
+    u32 block;
+    u8 rdram = addr >= 0x80000000 && addr < 0xC0000000 && (addr & 0x1FFFFFFF) + len <= 0x800000;
+
+    if ((len & 3) || len > 0x800000)rdram = 0;
+
+    addr = (addr & 0x1FFFFFFF) | 0x80000000;
+
+    //data for other addresses or a bad length is received and dropped, so the host stays in sync
+    for (u32 pos = 0; pos < len; pos += block) {
+
+        block = len - pos;
+        if (block > 512)block = 512;
+
+        if (rdram && (addr & 7) == 0) {
+            resp = bi_usb_rd((void *) (addr + pos), block);
+        } else {
+            resp = bi_usb_rd(buff, block);
+            if (rdram)memcpy((void *) (addr + pos), buff, block);
+        }
+        if (resp)return resp;
+    }
+
+    if (!rdram)return usbRespData(USB_ERR_ARG, 0, 0);
+
+    if ((addr & 7) != 0)data_cache_hit_writeback((void *) addr, len);
+    if ((flags & USB_WR_ICACHE))inst_cache_hit_invalidate((void *) addr, len);
+
+    return usbRespData(0, addr, len);
+}
+
+//file write to the sd card, length is the file size in bytes. a 512 byte block with the zero
+//terminated path follows, then the data padded to 512. the file is preallocated with f_expand,
+//so f_write goes straight to the card. usbFileTask receives the next blocks while the card is
+//busy programming the previous ones. reply has the FatFs result and the crc32 of the data.
+//the data is received even if the file can not be written, so the host stays in sync
+u8 usbCmdFileWR(u8 *cmd) {
+
+    u8 resp;
+    u8 path[512];
+    u8 *ring = (u8 *) usb_lz_out;
+    u32 len = *(u32 *) & cmd[8];
+    u32 step, bytes;
+    FIL f;
+    UINT bw;
+
+    resp = bi_usb_rd(path, sizeof (path));
+    if (resp)return resp;
+    path[sizeof (path) - 1] = 0;
+
+    memset(&usb_file, 0, sizeof (usb_file));
+    usb_file.size = len;
+    usb_file.blocks = (len + 511) / 512;
+    usb_file.crc = 0xFFFFFFFF;
+
+    if (usb_file.blocks)bi_usb_rd_start();
+
+    resp = f_open(&f, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (resp == 0) {
+        //contiguous clusters if the card has them, otherwise f_write allocates as usual
+        f_expand(&f, len, 1);
+    }
+
+    while (usb_file.wr < usb_file.blocks) {
+
+        step = usb_file.blocks - usb_file.wr;
+        if (step > USB_FILE_STEP)step = USB_FILE_STEP;
+
+        while (usb_file.rx < usb_file.wr + step && !usb_file.err)usbFileTask();
+        if (usb_file.err)break;
+
+        bytes = len - usb_file.wr * 512;
+        if (bytes > step * 512)bytes = step * 512;
+
+        if (resp == 0) {
+            bi_sd_idle(usbFileTask);
+            resp = f_write(&f, &ring[usb_file.wr % USB_FILE_RING * 512], bytes, &bw);
+            bi_sd_idle(0);
+            if (resp == 0 && bw != bytes)resp = FR_DENIED; //card is full
+        }
+
+        usb_file.wr += step;
+    }
+
+    //f_open invalidates the file object on error, f_close is harmless then
+    if (resp == 0) {
+        resp = f_close(&f);
+    } else {
+        f_close(&f);
+    }
+
+    if (usb_file.err)return usb_file.err;
+
+    return usbRespData(resp, len, usb_file.crc ^ 0xFFFFFFFF);
+}
+
+//receives the next block of the file write if the ring has room for it
+void usbFileTask() {
+
+    u8 *dst;
+    u32 len;
+
+    if (usb_file.err || usb_file.rx == usb_file.blocks)return;
+    if (usb_file.rx - usb_file.wr >= USB_FILE_RING)return;
+
+    dst = (u8 *) usb_lz_out + usb_file.rx % USB_FILE_RING * 512;
+    usb_file.err = bi_usb_rd_end(dst);
+    if (usb_file.err)return;
+
+    len = usb_file.size - usb_file.rx * 512;
+    if (len > 512)len = 512;
+
+    usb_file.rx++;
+    if (usb_file.rx < usb_file.blocks)bi_usb_rd_start();
+
+    usb_file.crc = usbCrc32(usb_file.crc, dst, len);
+}
+
+//framed write. header has address, length in bytes and transfer id.
+//it is followed by 512 bytes with crc32 of each 64K chunk, then by the data.
+//response has a mask of chunks with bad crc, the host sends them again
+u8 usbCmdRomWRX(u8 *cmd) {
+
+    u8 resp;
+    u8 buff[512];
+    u32 crc_tab[512 / 4];
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8];
+    u32 id = *(u32 *) & cmd[12];
+    u32 crc = 0xFFFFFFFF;
+    u32 bad[2] = {0, 0};
+
+    if (len == 0 || (len & 511) || len > USB_CHUNK * USB_WIN_CHUNKS) {
+        usbDrain();
+        return usbRespData(USB_ERR_ARG, 0, 0);
+    }
+
+    resp = bi_usb_rd(crc_tab, 512);
+    if (resp)return resp;
+
+    usbXferStart(id, addr, len);
+
+    bi_usb_rd_start();
+
+    for (u32 pos = 0; pos < len;) {
+
+        resp = bi_usb_rd_end(buff);
+        if (pos + 512 != len)bi_usb_rd_start(); //next block is received while this one goes to ROM
+        if (resp)return resp;
+        sysPI_wr(buff, addr + pos, 512);
+        crc = usbCrc32(crc, buff, 512);
+        pos += 512;
+
+        if ((pos & (USB_CHUNK - 1)) != 0 && pos != len)continue;
+
+        usbChunkEnd(addr, (pos - 1) / USB_CHUNK, (crc ^ 0xFFFFFFFF) == crc_tab[(pos - 1) / USB_CHUNK], bad);
+        crc = 0xFFFFFFFF;
+    }
+
+    return usbRespData(bad[0] | bad[1] ? 1 : 0, bad[1], bad[0]);
+}
+
+//end of a framed write chunk. only chunk aligned ROM writes are tracked for resume
+void usbChunkEnd(u32 addr, u32 chunk, u8 ok, u32 *bad) {
+
+    u32 idx = ((addr & 0x3FFFFFF) / USB_CHUNK) + chunk;
+
+    if (!ok) {
+        bad[chunk / 32] |= (u32) 1 << (chunk & 31);
+    } else if ((addr & (USB_CHUNK - 1)) == 0 && idx < USB_DONE_WORDS * 32) {
+        usb_done[idx / 32] |= (u32) 1 << (idx & 31);
+    }
+}
+
+//compressed write. same header and response as 'X', length is the decoded length.
+//each chunk is a frame of 512 byte blocks: compressed size, crc32 of the decoded chunk
+//and the LZ4 block. size with USB_LZ_STORED means raw data.
+//previous chunk is decoded and written to ROM while the blocks of the next one are received
+u8 usbCmdRomWRZ(u8 *cmd) {
+
+    u8 resp;
+    u8 *frame;
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8];
+    u32 id = *(u32 *) & cmd[12];
+    u32 bad[2] = {0, 0};
+    u32 size, blocks;
+    UsbLz lz;
+
+    if (len == 0 || (len & 511) || len > USB_CHUNK * USB_WIN_CHUNKS) {
+        usbDrain();
+        return usbRespData(USB_ERR_ARG, 0, 0);
+    }
+
+    usbXferStart(id, addr, len);
+
+    lz.len = 0;
+    lz.pos = 0;
+    lz.err = 0;
+
+    for (u32 chunk = 0; chunk * USB_CHUNK < len; chunk++) {
+
+        frame = (u8 *) usb_lz_in[chunk & 1];
+
+        bi_usb_rd_start();
+        usbLzStep(&lz, USB_LZ_STEP);
+        resp = bi_usb_rd_end(frame);
+        if (resp)return resp;
+
+        //frames which follow a bad size can not be found, the rest of the window is dropped
+        size = *(u32 *) & frame[0] & ~USB_LZ_STORED;
+        if (size > USB_CHUNK) {
+            usbDrain();
+            return usbRespData(USB_ERR_ARG, 0, 0);
+        }
+        blocks = (8 + size + 511) / 512;
+
+        for (u32 i = 1; i < blocks; i++) {
+            bi_usb_rd_start();
+            usbLzStep(&lz, USB_LZ_STEP);
+            resp = bi_usb_rd_end(&frame[i * 512]);
+            if (resp)return resp;
+        }
+
+        //previous chunk is finished without overlap if its frame was larger
+        if (lz.len) {
+            usbLzStep(&lz, USB_CHUNK);
+            usbChunkEnd(addr, chunk - 1, !lz.err && (lz.crc ^ 0xFFFFFFFF) == lz.crc_ref, bad);
+        }
+
+        lz.src = &frame[8];
+        lz.src_end = &frame[8 + size];
+        lz.addr = addr + chunk * USB_CHUNK;
+        lz.len = len - chunk * USB_CHUNK;
+        if (lz.len > USB_CHUNK)lz.len = USB_CHUNK;
+        lz.pos = 0;
+        lz.wr = 0;
+        lz.crc = 0xFFFFFFFF;
+        lz.crc_ref = *(u32 *) & frame[4];
+        lz.stored = (*(u32 *) & frame[0] & USB_LZ_STORED) != 0;
+        lz.err = lz.stored && size != lz.len;
+    }
+
+    usbLzStep(&lz, USB_CHUNK);
+    usbChunkEnd(addr, (len - 1) / USB_CHUNK, !lz.err && (lz.crc ^ 0xFFFFFFFF) == lz.crc_ref, bad);
+
+    return usbRespData(bad[0] | bad[1] ? 1 : 0, bad[1], bad[0]);
+}
+
+//data of a command which can not be parsed is received until the host waits for the reply
+void usbDrain() {
+
+    u8 buff[512];
+    u32 time = get_ticks_ms();
+
+    while (get_ticks_ms() - time < USB_DRAIN_MS) {
+
+        if (!bi_usb_can_rd())continue;
+        if (bi_usb_rd(buff, sizeof (buff)))return;
+        time = get_ticks_ms();
+    }
+}
+
+//decode at least step bytes of the chunk (if any left), update the crc and write them to ROM
+void usbLzStep(UsbLz *lz, u32 step) {
+
+    u8 *out = lz->stored ? lz->src : (u8 *) usb_lz_out;
+    u8 *src = lz->src;
+    u32 end = lz->pos + step;
+    u32 pos = lz->pos;
+
+    if (lz->pos == lz->len || lz->err)return;
+    if (end > lz->len)end = lz->len;
+
+    if (lz->stored) {
+        pos = end;
+    } else if (usbLzDecode(&src, lz->src_end, out, &pos, end, lz->len)) {
+        lz->err = 1;
+        return;
+    }
+
+    lz->crc = usbCrc32(lz->crc, &out[lz->pos], pos - lz->pos);
+    lz->src = src;
+    lz->pos = pos;
+
+    //matches may point back to anything decoded, so the buffer is written in place
+    if (pos != lz->len)pos &= ~7;
+    sysPI_wr(&out[lz->wr], lz->addr + lz->wr, pos - lz->wr);
+    lz->wr = pos;
+}
+
+//LZ4 block sequences: token, literals, match offset and length.
+//decodes until end, a block which does not decode to exactly len bytes is broken
+u8 usbLzDecode(u8 **src_ptr, u8 *src_end, u8 *out, u32 *pos_ptr, u32 end, u32 len) {
+
+    u8 *src = *src_ptr;
+    u32 pos = *pos_ptr;
+    u32 count, offset;
+    u8 token;
+
+    while (pos < end) {
+
+        if (src >= src_end)return 1;
+        token = *src++;
+        count = usbLzLen(&src, src_end, token >> 4);
+        if (src + count > src_end || pos + count > len)return 1;
+        memcpy(&out[pos], src, count);
+        src += count;
+        pos += count;
+        if (src == src_end)continue;
+
+        if (src + 2 > src_end)return 1;
+        offset = src[0] | (src[1] << 8);
+        src += 2;
+        count = usbLzLen(&src, src_end, token & 15) + 4;
+        if (offset == 0 || offset > pos || pos + count > len)return 1;
+
+        if (offset >= count) {
+            memcpy(&out[pos], &out[pos - offset], count);
+            pos += count;
+        } else {
+            while (count--) {
+                out[pos] = out[pos - offset];
+                pos++;
+            }
+        }
+    }
+
+    if (pos == len && src != src_end)return 1;
+
+    *src_ptr = src;
+    *pos_ptr = pos;
+
+    return 0;
+}
+
+//LZ4 length field, extended with 255 bytes
+u32 usbLzLen(u8 **src, u8 *src_end, u32 len) {
+
+    u8 val;
+
+    if (len != 15)return len;
+
+    do {
+        if (*src >= src_end)return 0xFFFFFF;
+        val = *(*src)++;
+        len += val;
+    } while (val == 255);
+
+    return len;
+}
+
+//bitmap of ROM chunks received by the transfer. empty if it is another transfer,
+//the bitmap is cleared by the first window of the new one
+u8 usbCmdQuery(u8 *cmd) {
+
+    u8 resp;
+    u32 id = *(u32 *) & cmd[12];
+
+    resp = usbRespData(0, id, sizeof (usb_done));
+    if (resp)return resp;
+
+    if (id != usb_xfer_id) {
+        memset(usb_lz_out, 0, sizeof (usb_done));
+        return bi_usb_wr(usb_lz_out, sizeof (usb_done));
+    }
+
+    return bi_usb_wr(usb_done, sizeof (usb_done));
+}
+
+//first window of a transfer. chunks of the previous one are forgotten and records of other
+//loads are dropped once, later windows and a resumed transfer leave the rom as it is
+void usbXferStart(u32 id, u32 addr, u32 len) {
+
+    if (id == usb_xfer_id)return;
+
+    memset(usb_done, 0, sizeof (usb_done));
+    usb_xfer_id = id;
+    usbRomDirty(addr, len);
+}
+
+//rom is written by another path, chunks of the last transfer can not be resumed
+void usbXferReset() {
+
+    memset(usb_done, 0, sizeof (usb_done));
+    usb_xfer_id = 0;
+}
+
+//rom range is written by the usb loader
+void usbRomDirty(u32 addr, u32 len) {
+
+    usbRecClear(addr, len);
+    fmResClear(addr, len); //file manager rom is overwritten
+}
+
+//hash of each 64K chunk of the rom area, FNV-1a over words. last chunk is hashed up to len.
+//no hashes are sent if the upload record is valid and has the id the host knows
+u8 usbCmdHash(u8 *cmd) {
+
+    u8 resp;
+    u8 *buff = (u8 *) usb_lz_out;
+    u32 *hash = (u32 *) usb_lz_in;
+    u32 *ptr = (u32 *) buff;
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8];
+    u32 id = *(u32 *) & cmd[12];
+    u32 count = (len + USB_CHUNK - 1) / USB_CHUNK;
+    u32 block;
+    UsbRecord *rec = (UsbRecord *) buff;
+
+    if (len == 0 || (len & 511) || (addr & 511) || count > BI_SIZE_ROM / USB_CHUNK) {
+        return usbRespData(USB_ERR_ARG, 0, 0);
+    }
+
+    sysPI_rd(rec, USB_REC_ADDR, sizeof (UsbRecord));
+    if (id != 0 && rec->magic == USB_REC_MAGIC && rec->sum == usbRecSum(rec) &&
+            rec->id == id && rec->addr == addr && rec->hash == sysHashPI(rec->addr, rec->len)) {
+        return usbRespData(0, 0, 0);
+    }
+
+    for (u32 i = 0; i < count; i++) {
+
+        block = len - i * USB_CHUNK;
+        if (block > USB_CHUNK)block = USB_CHUNK;
+        sysPI_rd(buff, addr + i * USB_CHUNK, block);
+
+        hash[i] = 0x811C9DC5;
+        for (u32 u = 0; u < block / 4; u++) {
+            hash[i] = (hash[i] ^ ptr[u]) * 0x01000193;
+        }
+    }
+
+    resp = usbRespData(0, count, count * 4);
+    if (resp)return resp;
+
+    return bi_usb_wr(hash, count * 4);
+}
+
+//host sends it after the whole image is uploaded. images without room for the record have none
+u8 usbCmdRecord(u8 *cmd) {
+
+    UsbRecord *rec = (UsbRecord *) usb_lz_out;
+    u32 addr = *(u32 *) & cmd[4];
+    u32 len = *(u32 *) & cmd[8];
+
+    if (len == 0 || (len & 511) || (addr & 511))return usbRespData(USB_ERR_ARG, 0, 0);
+
+    //the record area is a part of the image then, it is not written
+    if ((addr & 0x3FFFFFF) + len > (USB_REC_ADDR & 0x3FFFFFF))return usbRespData(0, 0, 0);
+
+    memset(rec, 0, sizeof (UsbRecord));
+    rec->magic = USB_REC_MAGIC;
+    rec->id = *(u32 *) & cmd[12];
+    rec->addr = addr;
+    rec->len = len;
+    rec->hash = sysHashPI(addr, len);
+    rec->sum = usbRecSum(rec);
+    sysPI_wr(rec, USB_REC_ADDR, sizeof (UsbRecord));
+
+    return usbRespData(0, 0, 0);
+}
+
+u32 usbRecSum(UsbRecord *rec) {
+    return rec->magic + rec->id + rec->addr + rec->len + rec->hash;
+}
+
+//drops the record if it is valid. a record inside the rom range which the caller writes is left,
+//it is overwritten anyway and the range may be in rom already
+void usbRecClear(u32 addr, u32 len) {
+
+    u64 buff[sizeof (UsbRecord) / 8];
+    UsbRecord *rec = (UsbRecord *) buff;
+
+    if (((USB_REC_ADDR - addr) & 0x3FFFFFF) < len)return;
+
+    sysPI_rd(rec, USB_REC_ADDR, sizeof (UsbRecord));
+    if (rec->magic != USB_REC_MAGIC || rec->sum != usbRecSum(rec))return;
+
+    memset(buff, 0, sizeof (buff));
+    sysPI_wr(buff, USB_REC_ADDR, sizeof (UsbRecord));
+}
+
+//crc32, reflected 0xEDB88320 polynomial. table is built on the first call
+u32 usbCrc32(u32 crc, u8 *src, u32 len) {
+
+    u32 val;
+
+    if (usb_crc_tab[1] == 0) {
+        for (u32 i = 0; i < 256; i++) {
+            val = i;
+            for (u32 u = 0; u < 8; u++) {
+                val = (val & 1) ? (val >> 1) ^ 0xEDB88320 : val >> 1;
+            }
+            usb_crc_tab[i] = val;
+        }
+    }
+
+    while (len--) {
+        crc = usb_crc_tab[(crc ^ *src++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
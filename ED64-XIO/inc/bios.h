@@ -60,6 +60,8 @@ u8 bi_usb_rd(void *dst, u32 len);
 u8 bi_usb_wr(void *src, u32 len);
 void bi_usb_rd_start();
 u8 bi_usb_rd_end(void *dst);
+void bi_usb_wr_start(void *src);
+u8 bi_usb_wr_end();
 
 
 void bi_sd_speed(u8 speed);
@@ -70,11 +72,14 @@ u8 bi_sd_dat_rd();
 void bi_sd_dat_wr(u8 val);
 u8 bi_sd_to_ram(void *dst, u16 slen);
 u8 bi_sd_to_rom(u32 dst, u16 slen);
+void bi_sd_idle(void (*callback)());
 u8 bi_ram_to_sd(void *src, u16 slen);
 
 void bi_game_cfg_set(u8 type); //set save type
 void bi_wr_swap(u8 swap_on);
 u32 bi_get_cart_id();
+void bi_dd_tbl_rd(void *dst);
+void bi_dd_tbl_clr();
 
 
 
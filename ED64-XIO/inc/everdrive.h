@@ -12,11 +12,21 @@
 #include "bios.h"
 #include "disk.h"
 #include "ff.h"
+#include "romlib.h"
+#include "save.h"
 
 void boot_simulator(u8 cic);
+void idleTask();
 u8 fmanager();
+void fmResClear(u32 addr, u32 len);
 void usbTerminal();
 void usbLoadGame();
+void usbRecClear(u32 addr, u32 len);
+void usbXferReset();
+void usbService();
+void usbLogString(u8 *str);
+void usbLogHex32(u32 val);
+void usbLogFlush();
 u8 fileRead();
 u8 fileWrite();
 
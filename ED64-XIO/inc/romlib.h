@@ -0,0 +1,50 @@
+/*
+ * File:   romlib.h
+ *
+ * Card-wide ROM library index
+ */
+
+#ifndef ROMLIB_H
+#define	ROMLIB_H
+
+#define ROMLIB_FILE     "ED64/romlib.bin"
+#define ROMLIB_MAGIC    0x4544524C //"EDRL"
+
+//byte order of the rom image
+#define ROM_ORDER_BE    0 //.z64, 80 37 12 40
+#define ROM_ORDER_BS    1 //.v64, byte swapped
+#define ROM_ORDER_LE    2 //.n64, little endian words
+
+#define ROM_SAVE_UNKNOWN 0xFF
+
+//library record, followed by the zero terminated path of path_len bytes
+typedef struct {
+    u32 size;
+    u32 mtime; //fdate << 16 | ftime
+    u32 crc1;
+    u32 crc2;
+    u8 title[20];
+    u8 game_id[4]; //media, cart id, cart id, region
+    u8 version;
+    u8 order;
+    u8 save; //SAVE_xxx from the developer override or save_db.txt, ROM_SAVE_UNKNOWN if not detected
+    u8 cfg; //1: rtc, 2: region free
+    u16 path_len;
+    u16 rsv;
+} RomInfo;
+
+typedef struct {
+    u32 magic;
+    u32 count;
+    u32 rsv[2];
+} RomLibHdr;
+
+void romlibTask();
+void romlibStop();
+u8 romlibBusy();
+u32 romlibCount();
+u8 romlibOpen(FIL *f, u32 *count);
+u8 romlibNext(FIL *f, RomInfo *inf, u8 *path, u32 path_max);
+u8 romlibFind(u8 *path, RomInfo *inf);
+
+#endif	/* ROMLIB_H */
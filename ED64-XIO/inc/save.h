@@ -0,0 +1,41 @@
+/*
+ * File:   save.h
+ *
+ * Backup ram saves of the launched game
+ */
+
+#ifndef SAVE_H
+#define	SAVE_H
+
+#define SAVE_DIR        "ED64/saves"
+#define SAVE_PATH_LEN   496
+#define SAVE_CHUNK      0x4000 //bytes per transfer step
+#define SAVE_READ_STEP  512 //backup ram bytes read per card busy poll
+#define SAVE_PAGE       0x1000 //backup ram is compared with the save file in pages
+#define SAVE_PAGES      (BI_SIZE_BRM / SAVE_PAGE)
+#define SAVE_TAG_ADDR   (BI_ADDR_ROM + BI_SIZE_ROM - 0x800) //session record, kept in cart memory over reset
+#define SAVE_STAGE_ADDR (SAVE_TAG_ADDR - SAVE_CHUNK) //roms which end above it leave no room for the tag
+#define SAVE_TAG_MAGIC  0x45445331 //"EDS1"
+
+//game session. save files of the running game, written back on the next menu start
+typedef struct {
+    u32 magic;
+    u32 type;
+    u32 sum;
+    u32 disk_addr; //rom address of the 64DD image, 0 if there is no disk
+    u32 hashed; //page_hash is valid, the save file has the full size
+    u8 path[SAVE_PATH_LEN];
+    u8 disk_path[SAVE_PATH_LEN];
+    u32 page_hash[SAVE_PAGES]; //backup ram pages as restored from the save file
+} SaveTag;
+
+u32 saveSize(u8 type);
+u8 saveStart(u8 *rom_path, u32 rom_size, u8 *disk_path, u32 disk_addr, u32 disk_size);
+u8 saveBackup();
+u8 saveRestore(u8 *path, u8 type);
+u8 saveDump(u8 *path, u8 type);
+u8 saveFlush(u8 *path, u8 type, u32 *page_hash);
+u8 saveStat(u32 *written, u32 *skipped);
+u8 saveDiskFlush(u8 *path, u32 addr);
+
+#endif	/* SAVE_H */
@@ -82,6 +82,9 @@
 #define VI_CONTROL_REG  VI_STATUS_REG
 #define VI_CURRENT_REG  (VI_BASE_REG+0x10)
 
+#define SYS_HASH_SAMPLES    32 //blocks hashed by sysHashPI
+#define SYS_HASH_BLOCK      256
+
 #define RGB(r, g, b) ((r << 11) | (g << 6) | (b << 1))
 
 typedef struct {
@@ -115,6 +118,7 @@ typedef struct {
 void sysInit();
 void sysPI_rd(void *ram, unsigned long pi_address, unsigned long len);
 void sysPI_wr(void *ram, unsigned long pi_address, unsigned long len);
+u32 sysHashPI(u32 pi_address, u32 len);
 
 
 
@@ -146,7 +150,9 @@ void gAppendHex8(u8 val);
 void gAppendHex16(u16 val);
 void gAppendHex32(u32 val);
 void gAppendHex32(u32 val);
+void gAppendNum(u32 num);
 void gRepaint();
 void gVsync();
+u8 gVsyncPoll();
 
 #endif	/* SYS_H */
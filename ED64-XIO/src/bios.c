@@ -90,6 +90,7 @@ void bi_usb_init();
 u8 bi_usb_busy();
 
 u16 bi_sd_cfg;
+void (*bi_sd_idle_cb)();
 
 void bi_init() {
 
@@ -232,6 +233,20 @@ u8 bi_usb_rd_end(void *dst) {
 
     return 0;
 }
+
+//copy 512 bytes to the internal buffer and start the transmission.
+//next block can be prepared until bi_usb_wr_end
+void bi_usb_wr_start(void *src) {
+
+    bi_reg_wr(REG_USB_CFG, USB_CMD_WR_NOP);
+    sysPI_wr(src, REG_ADDR(REG_USB_DAT), 512);
+    bi_reg_wr(REG_USB_CFG, USB_CMD_WR);
+}
+
+u8 bi_usb_wr_end() {
+
+    return bi_usb_busy();
+}
 //****************************************************************************** sdio
 //******************************************************************************
 //******************************************************************************
@@ -344,6 +359,7 @@ u8 bi_sd_to_rom(u32 dst, u16 slen) {
 
     bi_sd_switch_mode(REG_SD_DAT_RD);
     while ((resp & DMA_STA_BUSY)) {
+        if (bi_sd_idle_cb)bi_sd_idle_cb();
         resp = bi_reg_rd(REG_DMA_STA);
     }
 
@@ -352,6 +368,13 @@ u8 bi_sd_to_rom(u32 dst, u16 slen) {
     return 0;
 }
 
+//callback is called while the sd to rom dma is busy or the card programs a written block.
+//it should not use sd registers, during the dma it should not use PI bus
+void bi_sd_idle(void (*callback)()) {
+
+    bi_sd_idle_cb = callback;
+}
+
 u8 bi_ram_to_sd(void *src, u16 slen) {
 
     u8 resp;
@@ -391,10 +414,12 @@ u8 bi_ram_to_sd(void *src, u16 slen) {
             return 3;
         }
 
+        //card is busy programming the block
         for (int i = 0;; i++) {
 
             if (bi_sd_dat_rd() == 0xff)break;
             if (i == 65535)return 4;
+            if (bi_sd_idle_cb)bi_sd_idle_cb();
         }
     }
 
@@ -552,3 +577,17 @@ u32 bi_get_cart_id() {
 
     return bi_reg_rd(REG_EDID);
 }
+
+//64DD pages written by the game. one byte per BI_DD_PGE_SIZE page of the rom space, not zero if modified
+void bi_dd_tbl_rd(void *dst) {
+
+    sysPI_rd(dst, REG_ADDR(REG_DD_TBL), BI_DD_TBL_SIZE);
+}
+
+void bi_dd_tbl_clr() {
+
+    u64 buff[BI_DD_TBL_SIZE / 8];
+
+    memset(buff, 0, sizeof (buff));
+    sysPI_wr(buff, REG_ADDR(REG_DD_TBL), BI_DD_TBL_SIZE);
+}
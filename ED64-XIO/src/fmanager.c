@@ -1,133 +1,1224 @@
 
 #include "everdrive.h"
 
-u8 fmLoadDir(u8 *path, FILINFO *inf, u32 max_items);
+#define FM_MAX_ITEMS    8192 //directory items kept in the arena
+#define FM_NAME_HEAP    0x40000 //name storage, 256K
+#define FM_PATH_LEN     512
+#define FM_WIN_ROWS     (G_SCREEN_H - G_BORDER_Y * 2 - 2) //path line and status line
+#define FM_STREAM_SLICE 48 //f_readdir calls per frame while the directory is loading
+#define FM_REPEAT_DELAY 16 //frames before held up/down starts to repeat
+#define FM_CACHE_DIR    "ED64/cache"
+#define FM_CACHE_MIN    64 //folders with fewer items are not cached
+#define FM_SIG_SLICE    256 //raw dir entries checked per frame
+#define FM_IDX_MAGIC    0x45444932 //"EDI2"
+#define FM_SORT_SMALL   16 //sort buckets up to this size are finished with insertion sort
+#define FM_PRE_DELAY    30 //frames the cursor rests on a file before it is loaded to rom in background
+#define FM_PRE_SLICE    0x10000 //bytes prefetched per frame
+#define FM_BOUNCE       0x4000 //ram buffer for rom parts which can't be read straight to rom
+#define FM_RES_ADDR     (BI_ADDR_ROM + BI_SIZE_ROM - 0x200) //residency record, last sector of the rom space
+#define FM_RES_MAGIC    0x45445231 //"EDR1"
+#define FM_SWAP_STEP    64 //words swapped per dma status poll
+
+//byte order of the rom image
+#define FM_SWAP_NONE    0 //.z64
+#define FM_SWAP_HALF    1 //.v64, bytes swapped in halfwords
+#define FM_SWAP_WORD    2 //.n64, little endian words
+
+#define FM_SORT_DISK    0 //order of the entries in the dir
+#define FM_SORT_NAME    1
+#define FM_SORT_SIZE    2 //smaller first, then name
+#define FM_SORT_KEYS    3
+#define FM_SORT_DIRS    0x80 //flag, directories first
+
+//compact directory item. attributes in bits 31-24, name offset in bits 23-0
+typedef struct {
+    u32 size;
+    u32 name;
+} FmItem;
+
+#define FM_ATTR(it)     ((it)->name >> 24)
+#define FM_NAME(it)     (&fm_list.names[(it)->name & 0xFFFFFF])
+
+typedef struct {
+    FmItem item[FM_MAX_ITEMS];
+    u8 names[FM_NAME_HEAP];
+    u32 count;
+    u32 heap_len;
+    u8 loading;
+    u8 truncated;
+} FmList;
+
+//listing index file: header, items, names
+typedef struct {
+    u32 magic;
+    u32 sclust;
+    u32 nent;
+    u32 sum;
+    u32 count;
+    u32 heap_len;
+    u8 truncated;
+    u8 sort;
+    u8 rsv[2];
+    u32 data_sum; //hash of the items and names
+} FmIndexHdr;
+
+//sort record. key is the case-folded name prefix, the file size or the name offset
+typedef struct {
+    u32 key;
+    u32 idx;
+} FmSortRec;
+
+//rom prefetch. the file stays open, so the transfer resumes where it stopped
+typedef struct {
+    FIL f;
+    u8 path[FM_PATH_LEN];
+    u32 ofs; //rom position in the file
+    u32 size;
+    u32 done; //bytes already in rom
+    u32 sclust;
+    u32 mtime;
+    u32 ms_disk; //time spent in disk reads to rom, with the .n64 swap steps run while the card is busy
+    u8 open;
+    u8 swap;
+} FmPrefetch;
+
+//.n64 extent in the bounce buffer, swapped while the disk dma is busy
+typedef struct {
+    u32 addr;
+    u32 len; //words
+    u32 pos;
+} FmSwap;
+
+//identity of the rom in memory. kept over reset, so the same game is not loaded again
+typedef struct {
+    u32 magic;
+    u32 sclust;
+    u32 size;
+    u32 mtime;
+    u32 hash; //sampled hash of the rom memory
+    u32 swap;
+    u32 sum; //sum of the fields above
+    u32 rsv;
+} FmResident;
+
+enum {
+    FM_SIG_OFF,
+    FM_SIG_VERIFY,
+    FM_SIG_SAVE
+};
+
+u8 fmOpenDir(u8 *path, u8 use_index);
+u8 fmStreamDir(u32 max_items);
+void fmCloseDir();
+u8 fmSigTask();
+u8 fmIndexLoad();
+u8 fmIndexSave();
+u32 fmIndexSum();
+u8 fmIndexValid();
+void fmSort();
+void fmDrawWindow(u32 selector, u32 top);
+u8 fmMakePath(u8 *dst, u8 *name);
+u8 fmPrefetch(FmItem *it);
+u8 fmPreOpen(u8 *path);
+u8 fmPreRead(u32 max_len);
+u8 fmPreBounce(u32 len, UINT *br);
+u8 fmPreWords(u32 len, UINT *br);
+void fmSwapTask();
+void fmSwapFlush();
+u8 fmZipEntry(u8 *hdr);
+void fmPreClose();
+u8 fmResCheck();
+void fmResSave();
 u8 fmLoadGame(u8 *path);
+void fmLoadInfo(u32 len, u32 ms);
 
-#define MAX_DIR_SIZE    20
-#define MAX_STR_LEN     36
+FmList fm_list;
+DIR fm_dir;
+u8 fm_dir_open;
+u8 fm_path[FM_PATH_LEN];
+u8 fm_sig_job;
+DIRSIG fm_sig;
+FmIndexHdr fm_idx;
+FmSortRec fm_sort[FM_MAX_ITEMS];
+u8 fm_sort_mode = FM_SORT_NAME | FM_SORT_DIRS;
+FmPrefetch fm_pre;
+FmSwap fm_swp;
+u64 fm_bounce[FM_BOUNCE / 8];
 
 u8 fmanager() {
 
-    FILINFO inf[MAX_DIR_SIZE];
-    u32 selector = 0;
     struct controller_data cd;
+    struct controller_data ch;
+    u8 path[FM_PATH_LEN];
+    u32 sel_stack[16];
+    u32 depth = 0;
+    u32 selector = 0;
+    u32 top = 0;
+    u32 hold = 0;
+    u32 rest = 0;
+    u32 rest_sel = 0;
+    u8 redraw = 1;
     u8 resp;
+    u8 *slash;
+    FmItem *it;
 
     //open root dir
-    resp = fmLoadDir("", inf, MAX_DIR_SIZE);
+    fm_path[0] = 0;
+    resp = fmOpenDir(fm_path, 1);
     if (resp)return resp;
 
 
     while (1) {
 
-        //print items
-        gCleanScreen();
-        for (int i = 0; i < MAX_DIR_SIZE && inf[i].fname[0]; i++) {
-            gConsPrint(selector == i ? ">" : " ");
-            u8 tmp = inf[i].fname[MAX_STR_LEN];
-            inf[i].fname[MAX_STR_LEN] = 0; //make sure that the printed string doesn't exceed max len
-            gAppendString(inf[i].fname);
-            inf[i].fname[MAX_STR_LEN] = tmp;
+        //only the visible window is printed. gRepaint waits for vsync
+        if (redraw) {
+            if (selector < top)top = selector;
+            if (selector >= top + FM_WIN_ROWS)top = selector - FM_WIN_ROWS + 1;
+            fmDrawWindow(selector, top);
+            gRepaint();
+        } else {
+            gVsync();
         }
+        redraw = 0;
 
-        gRepaint();
+        //big directories are loaded in slices, the list can be scrolled meanwhile.
+        //after that the listing index is checked or written in background,
+        //then the highlighted rom is prefetched
+        if (fm_list.loading) {
+            resp = fmStreamDir(FM_STREAM_SLICE);
+            if (resp)return resp;
+            redraw = 1;
+        } else if (fm_sig_job) {
+            resp = fmSigTask();
+            if (resp)return resp;
+            if (fm_list.loading)redraw = 1;
+        } else if (rest < FM_PRE_DELAY || selector >= fm_list.count || !fmPrefetch(&fm_list.item[selector])) {
+            idleTask();
+        }
 
-        //controls
-        while (1) {
+        //the cursor has to rest on a file for a while before it is prefetched
+        rest = selector == rest_sel ? rest + 1 : 0;
+        rest_sel = selector;
 
-            gVsync();
-            controller_scan();
-            cd = get_keys_down();
+        if (!fm_list.loading && fm_list.count && selector >= fm_list.count) {
+            selector = fm_list.count - 1;
+            redraw = 1;
+        }
 
-            if (cd.c[0].B)return 0;
+        controller_scan();
+        cd = get_keys_down();
+        ch = get_keys_held();
 
-            if (cd.c[0].up) {
-                if (selector != 0)selector--;
-                break;
+        //auto-repeat for held up/down
+        if (cd.c[0].up || cd.c[0].down) {
+            hold = 0;
+        } else if (ch.c[0].up || ch.c[0].down) {
+            if (++hold >= FM_REPEAT_DELAY) {
+                cd.c[0].up = ch.c[0].up;
+                cd.c[0].down = ch.c[0].down;
             }
+        }
 
-            if (cd.c[0].down) {
-                if ((selector + 1) < MAX_DIR_SIZE && inf[selector + 1].fname[0])selector++;
-                break;
+        if (cd.c[0].up) {
+            if (selector != 0)selector--;
+            redraw = 1;
+        }
+
+        if (cd.c[0].down) {
+            if (selector + 1 < fm_list.count)selector++;
+            redraw = 1;
+        }
+
+        if (cd.c[0].left || cd.c[0].L) {
+            selector = selector > FM_WIN_ROWS ? selector - FM_WIN_ROWS : 0;
+            redraw = 1;
+        }
+
+        if ((cd.c[0].right || cd.c[0].R) && fm_list.count != 0) {
+            selector += FM_WIN_ROWS;
+            if (selector >= fm_list.count)selector = fm_list.count - 1;
+            redraw = 1;
+        }
+
+        //start changes the sort key, Z toggles directories first
+        if (cd.c[0].start || cd.c[0].Z) {
+            if (cd.c[0].start) {
+                fm_sort_mode = (fm_sort_mode & FM_SORT_DIRS) | (((fm_sort_mode & ~FM_SORT_DIRS) + 1) % FM_SORT_KEYS);
+            } else {
+                fm_sort_mode ^= FM_SORT_DIRS;
             }
 
-            if (cd.c[0].A && !(inf[selector].fattrib & AM_DIR)) {
+            //the selected item stays selected. name offset identifies it after sorting
+            if (!fm_list.loading && selector < fm_list.count) {
+                u32 name = fm_list.item[selector].name;
+                fmSort();
+                for (selector = 0; fm_list.item[selector].name != name; selector++);
+                top = selector > FM_WIN_ROWS / 2 ? selector - FM_WIN_ROWS / 2 : 0;
+            }
+            redraw = 1;
+        }
 
-                gCleanScreen();
-                gConsPrint("loading...");
-                gRepaint();
+        if (cd.c[0].B) {
 
-                resp = fmLoadGame(inf[selector].fname);
-                if (resp)return resp;
+            fmCloseDir();
+            rest = 0;
+            if (depth == 0) {
+                fmPreClose(); //rom may be overwritten by other loaders
+                return 0;
+            }
+
+            //back to the parent dir, selection is restored once the parent is loaded up to it
+            slash = strrchr(fm_path, '/');
+            if (slash) {
+                *slash = 0;
+            } else {
+                fm_path[0] = 0;
+            }
+            selector = sel_stack[--depth];
+
+            resp = fmOpenDir(fm_path, 1);
+            while (resp == 0 && fm_list.loading && fm_list.count <= selector) {
+                resp = fmStreamDir(FM_STREAM_SLICE);
+            }
+            if (resp)return resp;
+            if (selector >= fm_list.count)selector = fm_list.count ? fm_list.count - 1 : 0;
+            top = selector > FM_WIN_ROWS / 2 ? selector - FM_WIN_ROWS / 2 : 0;
+            redraw = 1;
+        }
 
-                bi_game_cfg_set(SAVE_EEP16K); //set save type
-                boot_simulator(CIC_6102); //run the game
+        if (cd.c[0].A && selector < fm_list.count) {
+
+            it = &fm_list.item[selector];
+            if (fmMakePath(path, FM_NAME(it)))continue; //path too long
+
+            if ((FM_ATTR(it) & AM_DIR)) {
+
+                if (depth == sizeof (sel_stack) / sizeof (sel_stack[0]))continue;
+                fmCloseDir();
+                sel_stack[depth++] = selector;
+                strcpy(fm_path, path);
+                selector = 0;
+                top = 0;
+                rest = 0;
+
+                resp = fmOpenDir(fm_path, 1);
+                if (resp)return resp;
+                redraw = 1;
+                continue;
             }
+
+            fmCloseDir();
+
+            gCleanScreen();
+            gConsPrint("loading...");
+            gRepaint();
+
+            resp = fmLoadGame(path);
+            if (resp)return resp;
+            gRepaint();
+
+            resp = saveStart(path, fm_pre.size, 0, 0, 0); //set save type and restore the save
+            if (resp)return resp;
+            boot_simulator(CIC_6102); //run the game
         }
     }
 
     return 0;
 }
 
-u8 fmLoadDir(u8 *path, FILINFO *inf, u32 max_items) {
+//with use_index the list is taken from the listing index if there is one for this dir
+u8 fmOpenDir(u8 *path, u8 use_index) {
 
     u8 resp;
-    DIR dir;
 
-    resp = f_opendir(&dir, path);
+    fmCloseDir();
+    fm_list.count = 0;
+    fm_list.heap_len = 0;
+    fm_list.truncated = 0;
+    fm_list.loading = 0;
+
+    resp = f_opendir(&fm_dir, path);
     if (resp)return resp;
+    fm_dir_open = 1;
+    memset(&fm_sig, 0, sizeof (fm_sig));
 
-    //load directory items
-    for (int i = 0; i < max_items; i++) {
+    if (use_index && fmIndexLoad() == 0) {
+        //shown at once and compared with the dir entries in background
+        fm_sig_job = FM_SIG_VERIFY;
+        return 0;
+    }
 
-        resp = f_readdir(&dir, &inf[i]);
-        if (resp)return resp;
-        if (inf[i].fname[0] == 0)break; //no directory items anymore
+    fm_list.loading = 1;
+
+    return 0;
+}
+
+void fmStreamEnd() {
+
+    fm_list.loading = 0;
+    fmSort();
+
+    if (fm_list.count < FM_CACHE_MIN) {
+        fmCloseDir();
+        return;
+    }
+
+    //sign the dir entries in background and save the index
+    if (f_rewinddir(&fm_dir) != FR_OK) {
+        fmCloseDir();
+        return;
+    }
+    fm_sig_job = FM_SIG_SAVE;
+}
+
+//enumeration callback, copies the item to the arena. stops the enumeration when the arena is full
+int fmStreamEnt(DIR *dp, const ENTINFO *inf, void *arg) {
+
+    u32 len = 0;
+    u8 *name = &fm_list.names[fm_list.heap_len];
+    FmItem *it;
+
+    //long names are converted once more, straight to the arena
+    if (fm_list.count < FM_MAX_ITEMS && inf->ftrunc) {
+        len = f_entname(dp, name, FM_NAME_HEAP - fm_list.heap_len);
+        if (len)len++;
+    } else if (fm_list.count < FM_MAX_ITEMS && fm_list.heap_len + strlen(inf->fname) < FM_NAME_HEAP) {
+        len = strlen(inf->fname) + 1;
+        memcpy(name, inf->fname, len);
+    }
+
+    if (len == 0) {
+        fm_list.truncated = 1;
+        return 1;
     }
 
-    resp = f_closedir(&dir);
+    it = &fm_list.item[fm_list.count++];
+    it->size = inf->fsize > 0xFFFFFFFF ? 0xFFFFFFFF : inf->fsize;
+    it->name = fm_list.heap_len | (inf->fattrib << 24);
+    fm_list.heap_len += len;
+
+    return 0;
+}
+
+//reads up to max_items entries into the arena
+u8 fmStreamDir(u32 max_items) {
+
+    u8 resp;
+    UINT nent = max_items;
+
+    if (!fm_list.loading)return 0;
+
+    resp = f_enumdir(&fm_dir, 0, &nent, fmStreamEnt, 0);
     if (resp)return resp;
 
+    //no directory items anymore or the arena is full
+    if (f_eod(&fm_dir) || fm_list.truncated)fmStreamEnd();
+
     return 0;
 }
 
-u8 fmLoadGame(u8 *path) {
+void fmCloseDir() {
+
+    if (!fm_dir_open)return;
+    f_closedir(&fm_dir);
+    fm_dir_open = 0;
+    fm_list.loading = 0;
+    fm_sig_job = FM_SIG_OFF;
+}
+
+u8 fmSigTask() {
 
-    FIL f;
     u8 resp;
-    u8 header[8];
+    u8 job = fm_sig_job;
+
+    resp = f_dirsig(&fm_dir, FM_SIG_SLICE, &fm_sig);
+    if (resp)return resp;
+    if (!fm_sig.done)return 0;
+
+    fmCloseDir();
+
+    if (job == FM_SIG_SAVE) {
+        fmIndexSave(); //the browser works without the index, so errors are ignored
+        return 0;
+    }
+
+    if (fm_sig.nent == fm_idx.nent && fm_sig.sum == fm_idx.sum) {
+        //index is valid. it is saved again if it was sorted in other order
+        if (fm_idx.sort != fm_sort_mode)fmIndexSave();
+        return 0;
+    }
+
+    //index is stale. list the dir again, the new index is saved when done
+    return fmOpenDir(fm_path, 0);
+}
+
+void fmIndexPath(u8 *path, u32 sclust) {
+
+    u8 *ptr = &path[sizeof (FM_CACHE_DIR)];
+
+    strcpy(path, FM_CACHE_DIR "/00000000.idx");
+    for (int i = 7; i >= 0; i--) {
+        ptr[i] = "0123456789ABCDEF"[sclust & 15];
+        sclust >>= 4;
+    }
+}
+
+//index file is named after the start cluster of the dir and read in one pass
+u8 fmIndexLoad() {
+
+    FIL f;
     UINT br;
-    u32 fsize;
+    u8 resp;
+    u8 path[32];
+    u32 items_len;
 
+    fmIndexPath(path, fm_dir.obj.sclust);
     resp = f_open(&f, path, FA_READ);
     if (resp)return resp;
 
-    fsize = f.obj.objsize - f.fptr;
+    resp = f_read(&f, &fm_idx, sizeof (fm_idx), &br);
+    items_len = fm_idx.count * sizeof (FmItem);
+
+    if (resp == 0 && (br != sizeof (fm_idx) || fm_idx.magic != FM_IDX_MAGIC || fm_idx.sclust != fm_dir.obj.sclust)) {
+        resp = FR_NO_FILE;
+    }
+    if (resp == 0 && (fm_idx.count > FM_MAX_ITEMS || fm_idx.heap_len > FM_NAME_HEAP)) {
+        resp = FR_NO_FILE;
+    }
+    if (resp == 0 && f_size(&f) != sizeof (fm_idx) + items_len + fm_idx.heap_len) {
+        resp = FR_NO_FILE;
+    }
 
-    //read rom header
-    resp = f_read(&f, header, sizeof (header), &br);
+    if (resp == 0) {
+        resp = f_read(&f, fm_list.item, items_len, &br);
+    }
+    if (resp == 0) {
+        resp = f_read(&f, fm_list.names, fm_idx.heap_len, &br);
+    }
+    f_close(&f);
     if (resp)return resp;
 
-    //set read position
-    resp = f_lseek(&f, 0);
+    //torn or damaged file, the dir is scanned again
+    if (!fmIndexValid())return FR_NO_FILE;
+
+    fm_list.count = fm_idx.count;
+    fm_list.heap_len = fm_idx.heap_len;
+    fm_list.truncated = fm_idx.truncated;
+    if (fm_idx.sort != fm_sort_mode)fmSort();
+
+    return 0;
+}
+
+u8 fmIndexSave() {
+
+    FIL f;
+    UINT bw;
+    u8 resp;
+    u8 path[32];
+
+    memset(&fm_idx, 0, sizeof (fm_idx));
+    fm_idx.magic = FM_IDX_MAGIC;
+    fm_idx.sclust = fm_dir.obj.sclust;
+    fm_idx.nent = fm_sig.nent;
+    fm_idx.sum = fm_sig.sum;
+    fm_idx.count = fm_list.count;
+    fm_idx.heap_len = fm_list.heap_len;
+    fm_idx.truncated = fm_list.truncated;
+    fm_idx.sort = fm_sort_mode;
+    fm_idx.data_sum = fmIndexSum();
+
+    resp = f_mkdir("ED64");
+    if (resp == 0 || resp == FR_EXIST)resp = f_mkdir(FM_CACHE_DIR);
+    if (resp != 0 && resp != FR_EXIST)return resp;
+
+    fmIndexPath(path, fm_idx.sclust);
+    resp = f_open(&f, path, FA_WRITE | FA_CREATE_ALWAYS);
     if (resp)return resp;
 
-    if (header[1] == 0x80) {
-        //enable byte swapping for disk operations if rom image has swapped byte order
-        //affects only reading to ROM address space
-        bi_wr_swap(1);
+    resp = f_write(&f, &fm_idx, sizeof (fm_idx), &bw);
+    if (resp == 0) {
+        resp = f_write(&f, fm_list.item, fm_list.count * sizeof (FmItem), &bw);
+    }
+    if (resp == 0) {
+        resp = f_write(&f, fm_list.names, fm_list.heap_len, &bw);
+    }
+    if (resp) {
+        f_close(&f);
+        f_unlink(path);
+        return resp;
+    }
+
+    return f_close(&f);
+}
+
+//FNV-1a over the items and the name heap of the index
+u32 fmIndexSum() {
+
+    u8 *ptr = (u8 *) fm_list.item;
+    u32 hash = 0x811C9DC5;
+
+    for (u32 i = 0; i < fm_idx.count * sizeof (FmItem); i++) {
+        hash = (hash ^ ptr[i]) * 0x01000193;
+    }
+    for (u32 i = 0; i < fm_idx.heap_len; i++) {
+        hash = (hash ^ fm_list.names[i]) * 0x01000193;
+    }
+
+    return hash;
+}
+
+//loaded index has the saved hash and every name is inside the heap. the heap ends with
+//a terminator, so a name which starts inside it is terminated inside it
+u8 fmIndexValid() {
+
+    if (fm_idx.data_sum != fmIndexSum())return 0;
+    if (fm_idx.count == 0)return 1;
+    if (fm_idx.heap_len == 0 || fm_list.names[fm_idx.heap_len - 1] != 0)return 0;
+
+    for (u32 i = 0; i < fm_idx.count; i++) {
+        if ((fm_list.item[i].name & 0xFFFFFF) >= fm_idx.heap_len)return 0;
+    }
+
+    return 1;
+}
+
+void fmAppendStr(u8 *str, u32 max_len) {
+
+    while (*str && max_len--)gAppendChar(*str++);
+}
+
+void fmDrawWindow(u32 selector, u32 top) {
+
+    u32 len = strlen(fm_path);
+    FmItem *it;
+
+    gCleanScreen();
+
+    //current dir, the tail is shown if the path doesn't fit
+    gConsPrint("/");
+    if (len > G_MAX_STR_LEN - 1) {
+        gAppendString("..");
+        gAppendString(&fm_path[len - (G_MAX_STR_LEN - 3)]);
+    } else {
+        gAppendString(fm_path);
+    }
+
+    for (u32 i = top; i < top + FM_WIN_ROWS && i < fm_list.count; i++) {
+
+        it = &fm_list.item[i];
+        gConsPrint(i == selector ? ">" : " ");
+        if ((FM_ATTR(it) & AM_DIR)) {
+            fmAppendStr(FM_NAME(it), G_MAX_STR_LEN - 2);
+            gAppendChar('/');
+        } else {
+            fmAppendStr(FM_NAME(it), G_MAX_STR_LEN - 1);
+        }
+    }
+
+    gSetXY(G_BORDER_X, G_SCREEN_H - G_BORDER_Y - 1);
+    gSetPal(PAL_G1);
+    if (fm_list.loading) {
+        gAppendString("loading... ");
+        gAppendNum(fm_list.count);
+    } else if (fm_list.count == 0) {
+        gAppendString("empty");
+    } else {
+        gAppendNum(selector + 1);
+        gAppendString("/");
+        gAppendNum(fm_list.count);
+        if (fm_list.truncated)gAppendString(" (list truncated)");
+    }
+
+    gSetXY(G_SCREEN_W - G_BORDER_X - 10, G_SCREEN_H - G_BORDER_Y - 1);
+    gAppendString((fm_sort_mode & FM_SORT_DIRS) ? "/" : " ");
+    switch (fm_sort_mode & ~FM_SORT_DIRS) {
+        case FM_SORT_NAME:
+            gAppendString("     name");
+            break;
+        case FM_SORT_SIZE:
+            gAppendString("     size");
+            break;
+        default:
+            gAppendString("disk order");
+            break;
+    }
+}
+
+//first byte of a double byte character, the lead byte ranges of FatFs DbcTbl
+u8 fmDbcLead(u8 c) {
+
+#if FF_CODE_PAGE == 932
+    return (c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC);
+#elif FF_CODE_PAGE == 936 || FF_CODE_PAGE == 949 || FF_CODE_PAGE == 950
+    return c >= 0x81 && c <= 0xFE;
+#else
+    return 0;
+#endif
+}
+
+//ascii case folding of the name byte at pos. second bytes of double byte characters
+//are kept, the names are scanned from the start to find them
+u8 fmFold(u8 *name, u32 pos) {
+
+    u8 c = name[pos];
+    u32 i = 0;
+
+    while (i < pos)i += fmDbcLead(name[i]) ? 2 : 1;
+    if (i != pos)return c;
+
+    return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+//case-folded 4 bytes of the name from pos, zero padded
+u32 fmSortPrefix(u8 *name, u32 pos) {
+
+    u32 key = 0;
+
+    for (int i = 0; i < 4; i++) {
+        key <<= 8;
+        if (name[pos])key |= fmFold(name, pos++);
+    }
+
+    return key;
+}
+
+//byte of the sort key at the given depth. bytes 0-3 are the record key, the deeper ones come from the name
+u8 fmSortByte(FmSortRec *rec, u32 depth) {
+
+    u8 key = fm_sort_mode & ~FM_SORT_DIRS;
+
+    if (depth < 4)return rec->key >> (24 - depth * 8);
+    if (key == FM_SORT_SIZE)depth -= 4;
+
+    return fmFold(FM_NAME(&fm_list.item[rec->idx]), depth);
+}
+
+//records that share the first depth bytes get the next 4 bytes of the name as the key
+void fmSortRefill(FmSortRec *rec, u32 n, u32 depth) {
+
+    if ((fm_sort_mode & ~FM_SORT_DIRS) == FM_SORT_SIZE)depth -= 4;
+
+    for (u32 i = 0; i < n; i++) {
+        rec[i].key = fmSortPrefix(FM_NAME(&fm_list.item[rec[i].idx]), depth);
+    }
+}
+
+//no more key bytes after this one
+u8 fmSortLast(u32 depth, u8 val) {
+
+    u8 key = fm_sort_mode & ~FM_SORT_DIRS;
+
+    if (key == FM_SORT_DISK)return depth >= 3;
+    if (key == FM_SORT_SIZE && depth < 4)return 0;
+    return val == 0;
+}
+
+//full comparison of records equal up to depth
+s32 fmSortCmp(FmSortRec *a, FmSortRec *b, u32 depth) {
+
+    u8 va, vb;
+
+    for (;; depth++) {
+        va = fmSortByte(a, depth);
+        vb = fmSortByte(b, depth);
+        if (va != vb)return va - vb;
+        if (fmSortLast(depth, va))return 0;
+    }
+}
+
+//in-place MSD radix sort (american flag sort), one key byte per level. the key holds 4 levels,
+//then it is refilled from the name. other buckets are sorted recursively, the largest one
+//in the loop, so the recursion depth stays below log2(n)
+void fmSortRange(FmSortRec *rec, u32 n, u32 depth) {
+
+    u16 count[256];
+    u16 next[256];
+    u32 pos, big, b, v, shift;
+    FmSortRec r, tmp;
+
+    while (n > FM_SORT_SMALL) {
+
+        if (depth >= 4 && (depth & 3) == 0)fmSortRefill(rec, n, depth);
+        shift = 24 - (depth & 3) * 8;
+
+        memset(count, 0, sizeof (count));
+        for (u32 i = 0; i < n; i++)count[(rec[i].key >> shift) & 0xFF]++;
+
+        for (b = 0, pos = 0; b < 256; b++) {
+            next[b] = pos;
+            pos += count[b];
+        }
+
+        //move every record to its bucket
+        for (b = 0, pos = 0; b < 256; b++) {
+            pos += count[b];
+            while (next[b] < pos) {
+                r = rec[next[b]];
+                v = (r.key >> shift) & 0xFF;
+                while (v != b) {
+                    tmp = rec[next[v]];
+                    rec[next[v]++] = r;
+                    r = tmp;
+                    v = (r.key >> shift) & 0xFF;
+                }
+                rec[next[b]++] = r;
+            }
+        }
+
+        //next[b] is the end of bucket b now
+        big = 256;
+        for (b = 0; b < 256; b++) {
+            if (count[b] < 2 || fmSortLast(depth, b))continue;
+            if (big == 256 || count[b] > count[big]) {
+                if (big != 256)fmSortRange(&rec[next[big] - count[big]], count[big], depth + 1);
+                big = b;
+            } else {
+                fmSortRange(&rec[next[b] - count[b]], count[b], depth + 1);
+            }
+        }
+
+        if (big == 256)return;
+        rec = &rec[next[big] - count[big]];
+        n = count[big];
+        depth++;
+    }
+
+    //insertion sort with full comparison for the small buckets. keys are not used,
+    //fmSortByte takes the bytes past the first 4 from the name
+    for (u32 i = 1; i < n; i++) {
+        r = rec[i];
+        for (v = i; v > 0 && fmSortCmp(&rec[v - 1], &r, depth) > 0; v--)rec[v] = rec[v - 1];
+        rec[v] = r;
+    }
+}
+
+//sorts the arena items in fm_sort_mode order
+void fmSort() {
+
+    u8 key = fm_sort_mode & ~FM_SORT_DIRS;
+    u32 n = fm_list.count;
+    u32 dirs = 0;
+    u32 i, j;
+    FmItem *it;
+    FmItem tmp;
+
+    for (i = 0; i < n; i++) {
+
+        it = &fm_list.item[i];
+        fm_sort[i].idx = i;
+
+        if (key == FM_SORT_NAME) {
+            fm_sort[i].key = fmSortPrefix(FM_NAME(it), 0);
+        } else if (key == FM_SORT_SIZE) {
+            fm_sort[i].key = it->size;
+        } else {
+            fm_sort[i].key = it->name & 0xFFFFFF;
+        }
+    }
+
+    //directories to the front, then both parts are sorted separately
+    if ((fm_sort_mode & FM_SORT_DIRS)) {
+        for (i = 0, j = n; i < j;) {
+            if ((FM_ATTR(&fm_list.item[fm_sort[i].idx]) & AM_DIR)) {
+                i++;
+            } else {
+                FmSortRec r = fm_sort[i];
+                fm_sort[i] = fm_sort[--j];
+                fm_sort[j] = r;
+            }
+        }
+        dirs = i;
+        fmSortRange(fm_sort, dirs, 0);
+    }
+    fmSortRange(&fm_sort[dirs], n - dirs, 0);
+
+    //put the items in sorted order, cycle by cycle
+    for (i = 0; i < n; i++) {
+
+        if (fm_sort[i].idx == i)continue;
+        tmp = fm_list.item[i];
+        for (j = i;;) {
+            u32 k = fm_sort[j].idx;
+            fm_sort[j].idx = j;
+            if (k == i) {
+                fm_list.item[j] = tmp;
+                break;
+            }
+            fm_list.item[j] = fm_list.item[k];
+            j = k;
+        }
+    }
+}
+
+//dst = fm_path + "/" + name. returns 1 if the path doesn't fit
+u8 fmMakePath(u8 *dst, u8 *name) {
+
+    u32 len = strlen(fm_path);
+
+    if (len + strlen(name) + 2 > FM_PATH_LEN)return 1;
+
+    strcpy(dst, fm_path);
+    if (len)dst[len++] = '/';
+    strcpy(&dst[len], name);
+
+    return 0;
+}
+
+//background load of the highlighted file. returns 1 if some work was done
+u8 fmPrefetch(FmItem *it) {
+
+    u8 path[FM_PATH_LEN];
+
+    if ((FM_ATTR(it) & AM_DIR))return 0;
+    if (fmMakePath(path, FM_NAME(it)))return 0;
+
+    if (!fm_pre.open || strcmp(fm_pre.path, path) != 0) {
+        if (fmPreOpen(path))return 0;
+    }
+    if (fm_pre.done == fm_pre.size)return 0; //already in rom
+
+    //speculative load, errors just cancel it
+    if (fmPreRead(FM_PRE_SLICE))fmPreClose();
+
+    return 1;
+}
+
+//opens the rom for loading. the prefetch continues if it is the same file
+u8 fmPreOpen(u8 *path) {
+
+    u8 resp;
+    u8 header[30];
+    UINT br;
+    FILINFO inf;
+
+    if (fm_pre.open && strcmp(fm_pre.path, path) == 0)return 0;
+    fmPreClose();
+
+    resp = f_stat(path, &inf);
+    if (resp)return resp;
+    resp = f_open(&fm_pre.f, path, FA_READ);
+    if (resp)return resp;
+    fm_pre.open = 1;
+    strcpy(fm_pre.path, path);
+    fm_pre.done = 0;
+    fm_pre.ofs = 0;
+    fm_pre.size = f_size(&fm_pre.f);
+    fm_pre.sclust = fm_pre.f.obj.sclust;
+    fm_pre.mtime = (u32) inf.fdate << 16 | inf.ftime;
+
+    //read rom header. rom can be stored in a zip file
+    memset(header, 0, sizeof (header));
+    resp = f_read(&fm_pre.f, header, sizeof (header), &br);
+    if (resp == 0 && header[0] == 'P' && header[1] == 'K' && header[2] == 3 && header[3] == 4) {
+        resp = fmZipEntry(header);
+        if (resp == 0)resp = f_lseek(&fm_pre.f, fm_pre.ofs);
+        if (resp == 0)resp = f_read(&fm_pre.f, header, 8, &br);
+    }
+    if (resp) {
+        fmPreClose();
+        return resp;
+    }
+    if (fm_pre.size > BI_SIZE_ROM)fm_pre.size = BI_SIZE_ROM;
+
+    //enable byte swapping for disk operations if rom image has swapped byte order
+    fm_pre.swap = FM_SWAP_NONE;
+    if (header[0] == 0x37 && header[1] == 0x80)fm_pre.swap = FM_SWAP_HALF;
+    if (header[0] == 0x40 && header[1] == 0x12)fm_pre.swap = FM_SWAP_WORD;
+
+    //rom is still in memory since the last launch
+    if (fmResCheck() == 0) {
+        fm_pre.done = fm_pre.size;
+        return 0;
+    }
+    fmResClear(BI_ADDR_ROM, fm_pre.size);
+    usbRecClear(BI_ADDR_ROM, fm_pre.size); //usb upload is overwritten
+    usbXferReset();
+
+    return 0;
+}
+
+//first entry of the zip file, if it is stored without compression
+u8 fmZipEntry(u8 *hdr) {
+
+    u16 flags = hdr[6] | hdr[7] << 8;
+    u16 method = hdr[8] | hdr[9] << 8;
+    u32 size = hdr[18] | hdr[19] << 8 | hdr[20] << 16 | (u32) hdr[21] << 24;
+    u32 ofs = 30 + (hdr[26] | hdr[27] << 8) + (hdr[28] | hdr[29] << 8);
+
+    //encrypted or size is in the data descriptor
+    if (method != 0 || (flags & 0x09))return FR_NO_FILE;
+    if (ofs + size > f_size(&fm_pre.f) || size < 8)return FR_NO_FILE;
+
+    fm_pre.ofs = ofs;
+    fm_pre.size = size;
+
+    return 0;
+}
+
+//reads the next part of the rom. whole sectors go straight to rom,
+//head and tail of the rom and roms at unaligned file offsets go through the bounce buffer
+u8 fmPreRead(u32 max_len) {
+
+    u8 resp;
+    UINT br;
+    u32 len;
+    u32 pos;
+    u32 time;
+    u32 align = fm_pre.swap == FM_SWAP_WORD ? 3 : 1; //rom parts start at word or halfword
+
+    while (max_len && fm_pre.done < fm_pre.size) {
+
+        len = fm_pre.size - fm_pre.done;
+        if (len > max_len)len = max_len;
+        pos = fm_pre.ofs + fm_pre.done;
+
+        if ((pos & 511) == 0 && (fm_pre.ofs & align) == 0 && len >= 512) {
+
+            //swapping affects only reading to ROM address space.
+            //warning! file can be read directly to rom but not to bram
+            len &= ~511;
+            resp = f_lseek(&fm_pre.f, pos);
+            if (resp)return resp;
+            if (fm_pre.swap == FM_SWAP_WORD) {
+                resp = fmPreWords(len, &br);
+            } else {
+                time = get_ticks_ms();
+                bi_wr_swap(fm_pre.swap);
+                resp = f_read(&fm_pre.f, (void *) (BI_ADDR_ROM + fm_pre.done), len, &br);
+                bi_wr_swap(0);
+                fm_pre.ms_disk += get_ticks_ms() - time;
+            }
+        } else {
+
+            //unaligned head of the rom ends at the sector boundary
+            if ((fm_pre.ofs & align) == 0 && (pos & 511) != 0 && len > 512 - (pos & 511)) {
+                len = 512 - (pos & 511);
+            }
+            if (len > FM_BOUNCE - (pos & 511))len = FM_BOUNCE - (pos & 511);
+            if (len > align && fm_pre.done + len < fm_pre.size)len &= ~align; //next part starts aligned
+            resp = fmPreBounce(len, &br);
+        }
+        if (resp)return resp;
+
+        fm_pre.done += br;
+        max_len -= len;
+        if (br != len) {
+            fm_pre.size = fm_pre.done; //end of file
+        }
     }
 
-    //warning! file can be read directly to rom but not to bram
-    resp = f_read(&f, (void *) BI_ADDR_ROM, fsize, &br);
+    if (fm_pre.done == fm_pre.size)fmResSave();
+
+    return 0;
+}
+
+//reads whole sectors to ram and copies the requested part to rom with PI DMA
+u8 fmPreBounce(u32 len, UINT *br) {
+
+    u8 resp;
+    u8 *buff = (u8 *) fm_bounce;
+    u32 pos = fm_pre.ofs + fm_pre.done;
+    u32 skip = pos & 511;
+
+    resp = f_lseek(&fm_pre.f, pos - skip);
+    if (resp)return resp;
+    resp = f_read(&fm_pre.f, buff, (skip + len + 511) & ~511, br);
     if (resp)return resp;
 
-    bi_wr_swap(0);
+    *br = *br > skip ? *br - skip : 0;
+    if (*br > len)*br = len;
+    if (*br == 0)return 0;
+
+    //PI DMA needs aligned ram address, so the data is moved to the buffer start
+    if (skip)memmove(buff, buff + skip, *br);
+    if (fm_pre.swap == FM_SWAP_HALF) {
+        for (u32 i = 0; i < *br; i += 2) {
+            u8 tmp = buff[i];
+            buff[i] = buff[i + 1];
+            buff[i + 1] = tmp;
+        }
+    }
+    if (fm_pre.swap == FM_SWAP_WORD) {
+        for (u32 i = 0; i < *br; i += 4) {
+            u8 tmp = buff[i];
+            buff[i] = buff[i + 3];
+            buff[i + 3] = tmp;
+            tmp = buff[i + 1];
+            buff[i + 1] = buff[i + 2];
+            buff[i + 2] = tmp;
+        }
+    }
+
+    sysPI_wr(buff, BI_ADDR_ROM + fm_pre.done, (*br + 1) & ~1);
+
+    return 0;
+}
+
+//.n64 rom. disk dma swaps bytes in halfwords, then cpu swaps halfwords in words.
+//each extent goes back to ram and is swapped while the next one is read from disk
+u8 fmPreWords(u32 len, UINT *br) {
+
+    u8 resp;
+    UINT ext_br;
+    u32 ext;
+    u32 addr;
+    u32 time;
+
+    *br = 0;
+    fm_swp.len = 0;
+
+    while (*br < len) {
+
+        ext = len - *br;
+        if (ext > FM_BOUNCE)ext = FM_BOUNCE;
+        addr = BI_ADDR_ROM + fm_pre.done + *br;
+
+        time = get_ticks_ms();
+        bi_sd_idle(fmSwapTask);
+        bi_wr_swap(1);
+        resp = f_read(&fm_pre.f, (void *) addr, ext, &ext_br);
+        bi_wr_swap(0);
+        bi_sd_idle(0);
+        fm_pre.ms_disk += get_ticks_ms() - time;
+        if (resp)return resp;
+
+        fmSwapFlush();
+        if (ext_br == 0)break;
+        *br += ext_br;
+
+        fm_swp.addr = addr;
+        fm_swp.len = (ext_br + 3) / 4;
+        fm_swp.pos = 0;
+        sysPI_rd(fm_bounce, addr, fm_swp.len * 4);
+        if (ext_br != ext)break;
+    }
+
+    fmSwapFlush();
+
+    return 0;
+}
+
+void fmSwapTask() {
+
+    u32 *ptr = (u32 *) fm_bounce;
+    u32 end = fm_swp.pos + FM_SWAP_STEP;
+
+    if (end > fm_swp.len)end = fm_swp.len;
+
+    while (fm_swp.pos < end) {
+        ptr[fm_swp.pos] = ptr[fm_swp.pos] << 16 | ptr[fm_swp.pos] >> 16;
+        fm_swp.pos++;
+    }
+}
+
+//finishes the pending extent and writes it back to rom
+void fmSwapFlush() {
+
+    if (fm_swp.len == 0)return;
+
+    while (fm_swp.pos < fm_swp.len)fmSwapTask();
+    sysPI_wr(fm_bounce, fm_swp.addr, fm_swp.len * 4);
+    fm_swp.len = 0;
+}
+
+void fmPreClose() {
+
+    if (!fm_pre.open)return;
+    f_close(&fm_pre.f);
+    fm_pre.open = 0;
+}
+
+u32 fmResSum(FmResident *res) {
+    return res->magic + res->sclust + res->size + res->mtime + res->hash + res->swap;
+}
+
+//record is moved through the bounce buffer, PI DMA needs aligned ram address
+u8 fmResCheck() {
+
+    FmResident *res = (FmResident *) fm_bounce;
+
+    if (fm_pre.size < SYS_HASH_BLOCK || fm_pre.size > FM_RES_ADDR - BI_ADDR_ROM)return 1;
+
+    sysPI_rd(res, FM_RES_ADDR, sizeof (FmResident));
+    if (res->magic != FM_RES_MAGIC || res->sum != fmResSum(res))return 1;
+    if (res->sclust != fm_pre.sclust || res->size != fm_pre.size || res->mtime != fm_pre.mtime)return 1;
+    if (res->swap != fm_pre.swap)return 1;
+
+    return res->hash == sysHashPI(BI_ADDR_ROM, res->size) ? 0 : 1;
+}
+
+//stored after the whole file is in rom. roms without room for the record are always loaded
+void fmResSave() {
+
+    FmResident *res = (FmResident *) fm_bounce;
+
+    if (fm_pre.size < SYS_HASH_BLOCK || fm_pre.size > FM_RES_ADDR - BI_ADDR_ROM)return;
+
+    memset(res, 0, sizeof (FmResident));
+    res->magic = FM_RES_MAGIC;
+    res->sclust = fm_pre.sclust;
+    res->size = fm_pre.size;
+    res->mtime = fm_pre.mtime;
+    res->hash = sysHashPI(BI_ADDR_ROM, res->size);
+    res->swap = fm_pre.swap;
+    res->sum = fmResSum(res);
+    sysPI_wr(res, FM_RES_ADDR, sizeof (FmResident));
+}
+
+//drops the record if it is valid. a record inside the rom range which the caller writes is left
+void fmResClear(u32 addr, u32 len) {
+
+    FmResident *res = (FmResident *) fm_bounce;
+
+    if (((FM_RES_ADDR - addr) & 0x3FFFFFF) < len)return;
+
+    sysPI_rd(res, FM_RES_ADDR, sizeof (FmResident));
+    if (res->magic != FM_RES_MAGIC || res->sum != fmResSum(res))return;
+
+    memset(res, 0, sizeof (FmResident));
+    sysPI_wr(res, FM_RES_ADDR, sizeof (FmResident));
+}
+
+u8 fmLoadGame(u8 *path) {
+
+    u8 resp;
+    u32 len;
+    u32 time = get_ticks_ms();
+
+    resp = fmPreOpen(path);
     if (resp)return resp;
 
-    resp = f_close(&f);
+    len = fm_pre.size - fm_pre.done;
+    fm_pre.ms_disk = 0;
+    resp = fmPreRead(len);
+    fmPreClose();
     if (resp)return resp;
 
+    fmLoadInfo(len, get_ticks_ms() - time);
+
     return 0;
 }
+
+//load speed. for .n64 roms the speed of the disk reads is shown too, the swap steps
+//done in the idle callback are a part of it
+void fmLoadInfo(u32 len, u32 ms) {
+
+    if (len == 0) {
+        gConsPrint("rom is already in memory");
+        return;
+    }
+
+    if (ms == 0)ms = 1;
+    gConsPrint("");
+    gAppendNum(len / 1024);
+    gAppendString("K in ");
+    gAppendNum(ms);
+    gAppendString("ms, ");
+    gAppendNum((u64) len * 1000 / 1024 / ms);
+    gAppendString("K/s");
+
+    if (fm_pre.swap != FM_SWAP_WORD || fm_pre.ms_disk == 0)return;
+    gConsPrint("word swap, reads+swap ");
+    gAppendNum((u64) len * 1000 / 1024 / fm_pre.ms_disk);
+    gAppendString("K/s");
+}
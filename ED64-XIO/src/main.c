@@ -6,6 +6,10 @@ void edid();
 void printError(u8 err);
 u8 demoMenu();
 
+#define IDLE_FSCAN_SLICE    32 //FAT sectors counted per idle frame
+
+u32 disk_free_mb = 0xFFFFFFFF;
+
 int main(void) {
 
     u8 resp;
@@ -23,6 +27,10 @@ int main(void) {
     resp = f_mount(&fs, "", 1);
     if (resp)printError(resp);
 
+    //backup ram of the game played before reset goes to its save file
+    resp = saveBackup();
+    if (resp)printError(resp);
+
 
     while (1) {
         resp = demoMenu();
@@ -46,6 +54,7 @@ u8 demoMenu() {
     struct controller_data cd;
     u8 * menu[MENU_SIZE];
     u32 selector = 0;
+    u32 written, skipped;
     u8 resp;
 
     menu[MENU_FILE_MANAGER] = "File Manager";
@@ -69,7 +78,30 @@ u8 demoMenu() {
             gAppendString(menu[i]);
         }
 
+        gConsPrint("");
+        gConsPrint("          Free space: ");
+        if (disk_free_mb == 0xFFFFFFFF) {
+            gAppendString("counting...");
+        } else {
+            gAppendNum(disk_free_mb);
+            gAppendString(" MB");
+        }
+        gConsPrint("          ROM library: ");
+        if (romlibBusy()) {
+            gAppendString("indexing... ");
+        }
+        gAppendNum(romlibCount());
+        if (!romlibBusy())gAppendString(" ROMs");
+        if (saveStat(&written, &skipped)) {
+            gConsPrint("          Last save: ");
+            gAppendNum(written / 1024);
+            gAppendString("K written, ");
+            gAppendNum(skipped / 1024);
+            gAppendString("K unchanged");
+        }
+
         gRepaint();
+        idleTask();
         controller_scan();
         cd = get_keys_down();
 
@@ -122,6 +154,24 @@ u8 demoMenu() {
     }
 }
 
+//background jobs. called once per frame while the menu waits for user input
+void idleTask() {
+
+    FATFS *fs;
+    DWORD nclst;
+    u8 resp;
+
+    //if FSINFO has no valid free space value then FAT is scanned in small steps.
+    //f_scanfree returns immediately once the value is known
+    resp = f_scanfree("", IDLE_FSCAN_SLICE, &nclst, &fs);
+    if (resp == 0 && nclst != 0xFFFFFFFF) {
+        disk_free_mb = (u64) nclst * fs->csize / (0x100000 / 512);
+    }
+
+    //card-wide rom index is built after the free space count is done
+    if (disk_free_mb != 0xFFFFFFFF)romlibTask();
+}
+
 void edid() {
 
     struct controller_data cd;
@@ -187,6 +237,8 @@ void boot_simulator(u8 cic) {
     game_cic = cic;
     cheats_on = 0;
 
+    romlibStop(); //background index job must not leave the card mid-write
+
 
     // Start game via CIC boot code
     asm __volatile__(
@@ -0,0 +1,579 @@
+
+#include "everdrive.h"
+
+#define ROMLIB_TMP          "ED64/romlib.tmp"
+#define ROMLIB_SAVE_DB      "ED64/save_db.txt"
+#define ROMLIB_MAX_DEPTH    8 //nested dirs walked below the root
+#define ROMLIB_PATH_LEN     512
+#define ROMLIB_SLICE        16 //work units per frame. dir entry costs 1, rom header costs 8
+#define ROMLIB_HDR_COST     8
+#define ROMLIB_DB_RULES     512
+#define ROMLIB_OLD_SLOTS    8192 //hash table of the previous index, filled up to 3/4
+
+//save_db.txt rule. key is CRC1 or two ID characters
+typedef struct {
+    u32 key;
+    u8 by_crc;
+    u8 val; //save type in high nibble, config in low nibble
+} RomRule;
+
+//record of the previous index. located by path hash, checked by path, size and date
+typedef struct {
+    u32 hash;
+    u32 ofs;
+} RomOld;
+
+enum {
+    RL_START,
+    RL_OLD, //reading the previous index
+    RL_WALK,
+    RL_DONE
+};
+
+u8 romlibStart();
+u8 romlibOldTask(u32 budget);
+u8 romlibWalkTask(u32 budget);
+u8 romlibFinish();
+void romlibLoadDb();
+u8 romlibAddRom(ENTINFO *inf, u32 *budget);
+
+u8 rl_state;
+u32 rl_count;
+u32 rl_total;
+FIL rl_out;
+FIL rl_old;
+u8 rl_old_open;
+u32 rl_old_count;
+u32 rl_old_ofs;
+RomOld rl_old_tab[ROMLIB_OLD_SLOTS];
+u32 rl_old_used;
+DIR rl_dir[ROMLIB_MAX_DEPTH];
+u16 rl_plen[ROMLIB_MAX_DEPTH];
+u32 rl_depth;
+u8 rl_path[ROMLIB_PATH_LEN];
+RomRule rl_rules[ROMLIB_DB_RULES];
+u32 rl_rule_count;
+
+//called from idleTask. builds ED64/romlib.bin once per boot in small steps
+void romlibTask() {
+
+    u8 resp = 0;
+
+    switch (rl_state) {
+        case RL_START:
+            resp = romlibStart();
+            break;
+        case RL_OLD:
+            resp = romlibOldTask(ROMLIB_SLICE * 4);
+            break;
+        case RL_WALK:
+            resp = romlibWalkTask(ROMLIB_SLICE);
+            break;
+        default:
+            return;
+    }
+
+    //the library is optional, any error ends the job and keeps the previous index
+    if (resp)romlibStop();
+}
+
+u8 romlibBusy() {
+    return rl_state != RL_DONE;
+}
+
+//roms found so far, or roms in the index when done
+u32 romlibCount() {
+    return rl_state == RL_DONE ? rl_total : rl_count;
+}
+
+u8 romlibStart() {
+
+    RomLibHdr hdr;
+    UINT bw;
+    u8 resp;
+
+    rl_state = RL_DONE;
+    rl_count = 0;
+    rl_old_used = 0;
+    memset(rl_old_tab, 0, sizeof (rl_old_tab));
+
+    romlibLoadDb();
+
+    resp = f_mkdir("ED64");
+    if (resp != 0 && resp != FR_EXIST)return resp;
+
+    resp = f_opendir(&rl_dir[0], "");
+    if (resp)return resp;
+    rl_depth = 1;
+    rl_plen[0] = 0;
+    rl_path[0] = 0;
+
+    resp = f_open(&rl_out, ROMLIB_TMP, FA_WRITE | FA_CREATE_ALWAYS);
+    if (resp) {
+        f_closedir(&rl_dir[0]);
+        rl_depth = 0;
+        return resp;
+    }
+
+    //header is written again with the final count
+    memset(&hdr, 0, sizeof (hdr));
+    resp = f_write(&rl_out, &hdr, sizeof (hdr), &bw);
+
+    rl_state = RL_WALK;
+    if (resp)return resp;
+
+    //records of unchanged roms are copied from the previous index without opening the rom
+    if (romlibOpen(&rl_old, &rl_old_count) == 0) {
+        rl_old_open = 1;
+        rl_old_ofs = sizeof (hdr);
+        rl_state = RL_OLD;
+    }
+
+    return 0;
+}
+
+//ends the job and drops the unfinished index. called before a game starts, so no file
+//stays open for writing and the fat and free cluster count on the card are up to date
+void romlibStop() {
+
+    while (rl_depth) {
+        f_closedir(&rl_dir[--rl_depth]);
+    }
+    if (rl_old_open)f_close(&rl_old);
+    rl_old_open = 0;
+
+    if (rl_state != RL_DONE) {
+        f_close(&rl_out);
+        f_unlink(ROMLIB_TMP);
+    }
+    rl_total = rl_count;
+    rl_state = RL_DONE;
+}
+
+u32 romlibHash(u8 *str) {
+
+    u32 hash = 0x811C9DC5;
+
+    while (*str) {
+        hash = (hash ^ *str++) * 0x01000193;
+    }
+
+    return hash ? hash : 1;
+}
+
+u8 romlibOldTask(u32 budget) {
+
+    RomInfo inf;
+    UINT br;
+    u8 resp;
+    u8 path[ROMLIB_PATH_LEN];
+    u32 hash;
+
+    while (budget--) {
+
+        if (rl_old_count == 0 || rl_old_used == ROMLIB_OLD_SLOTS / 4 * 3) {
+            rl_state = RL_WALK;
+            return 0;
+        }
+        rl_old_count--;
+
+        resp = f_lseek(&rl_old, rl_old_ofs);
+        if (resp)return resp;
+        resp = f_read(&rl_old, &inf, sizeof (inf), &br);
+        if (resp == 0 && (br != sizeof (inf) || inf.path_len >= ROMLIB_PATH_LEN))resp = FR_INT_ERR;
+        if (resp == 0)resp = f_read(&rl_old, path, inf.path_len + 1, &br);
+        if (resp == 0 && br != inf.path_len + 1)resp = FR_INT_ERR;
+        if (resp)return resp;
+
+        path[inf.path_len] = 0;
+        hash = romlibHash(path);
+
+        for (u32 i = hash;; i++) {
+            if (rl_old_tab[i % ROMLIB_OLD_SLOTS].hash == 0) {
+                rl_old_tab[i % ROMLIB_OLD_SLOTS].hash = hash;
+                rl_old_tab[i % ROMLIB_OLD_SLOTS].ofs = rl_old_ofs;
+                break;
+            }
+        }
+        rl_old_used++;
+        rl_old_ofs += sizeof (inf) + inf.path_len + 1;
+    }
+
+    return 0;
+}
+
+//looks for rl_path in the previous index. returns 0 if the record is still valid
+u8 romlibOldFind(ENTINFO *fi, RomInfo *inf) {
+
+    u8 path[ROMLIB_PATH_LEN];
+    u32 hash;
+    u32 plen;
+    UINT br;
+    RomOld *old;
+
+    if (!rl_old_open)return 1;
+
+    hash = romlibHash(rl_path);
+    plen = strlen(rl_path);
+
+    for (u32 i = hash;; i++) {
+
+        old = &rl_old_tab[i % ROMLIB_OLD_SLOTS];
+        if (old->hash == 0)return 1;
+        if (old->hash != hash)continue;
+
+        if (f_lseek(&rl_old, old->ofs))return 1;
+        if (f_read(&rl_old, inf, sizeof (RomInfo), &br) || br != sizeof (RomInfo))return 1;
+        if (inf->path_len != plen || inf->size != fi->fsize)continue;
+        if (inf->mtime != ((u32) fi->fdate << 16 | fi->ftime))continue;
+        if (f_read(&rl_old, path, plen + 1, &br) || br != plen + 1)return 1;
+        if (memcmp(path, rl_path, plen) != 0)continue;
+
+        return 0;
+    }
+}
+
+//walk callback. dirs and roms stop the enumeration with the full path in rl_path
+int romlibEnt(DIR *dp, const ENTINFO *inf, void *arg) {
+
+    u32 plen = rl_plen[rl_depth - 1];
+
+    if (inf->fattrib & AM_DIR) {
+        if (inf->fattrib & (AM_HID | AM_SYS))return 0;
+        if (rl_depth == 1 && strcmp(inf->fname, "ED64") == 0)return 0;
+        if (rl_depth == ROMLIB_MAX_DEPTH)return 0;
+    } else if (inf->fsize < 0x1000 || inf->fsize > 0xFFFFFFFF) {
+        return 0;
+    }
+
+    if (plen)rl_path[plen++] = '/';
+    if (plen + 1 >= ROMLIB_PATH_LEN || f_entname(dp, &rl_path[plen], ROMLIB_PATH_LEN - plen) == 0) {
+        rl_path[rl_plen[rl_depth - 1]] = 0;
+        return 0; //path too long
+    }
+
+    memcpy(arg, inf, sizeof (ENTINFO));
+
+    return 1;
+}
+
+u8 romlibWalkTask(u32 budget) {
+
+    ENTINFO inf;
+    DIR *dir;
+    UINT nent;
+    u8 resp;
+
+    while (budget && rl_state == RL_WALK) {
+
+        if (rl_depth == 0)return romlibFinish();
+
+        dir = &rl_dir[rl_depth - 1];
+        rl_path[rl_plen[rl_depth - 1]] = 0;
+
+        //names of other files are not even converted
+        inf.fname[0] = 0;
+        nent = budget;
+        resp = f_enumdir(dir, "z64|v64|n64", &nent, romlibEnt, &inf);
+        if (resp)return resp;
+        budget = nent;
+
+        if (inf.fname[0] == 0) {
+            //end of dir. back to the parent
+            if (f_eod(dir)) {
+                f_closedir(dir);
+                rl_depth--;
+            }
+            continue;
+        }
+
+        if (inf.fattrib & AM_DIR) {
+            if (f_opendir(&rl_dir[rl_depth], rl_path) != FR_OK)continue;
+            rl_plen[rl_depth++] = strlen(rl_path);
+            continue;
+        }
+
+        resp = romlibAddRom(&inf, &budget);
+        if (resp)return resp;
+    }
+
+    return 0;
+}
+
+//rom header is converted to big endian order
+u8 romlibReadHeader(u8 *hdr, u8 *order) {
+
+    FIL f;
+    UINT br;
+    u8 resp;
+    u8 tmp;
+
+    resp = f_open(&f, rl_path, FA_READ);
+    if (resp)return resp;
+    resp = f_read(&f, hdr, 0x40, &br);
+    f_close(&f);
+    if (resp)return resp;
+    if (br != 0x40)return FR_NO_FILE;
+
+    if (hdr[0] == 0x80 && hdr[1] == 0x37) {
+        *order = ROM_ORDER_BE;
+    } else if (hdr[0] == 0x37 && hdr[1] == 0x80) {
+        *order = ROM_ORDER_BS;
+        for (int i = 0; i < 0x40; i += 2) {
+            tmp = hdr[i];
+            hdr[i] = hdr[i + 1];
+            hdr[i + 1] = tmp;
+        }
+    } else if (hdr[0] == 0x40 && hdr[1] == 0x12) {
+        *order = ROM_ORDER_LE;
+        for (int i = 0; i < 0x40; i += 4) {
+            tmp = hdr[i];
+            hdr[i] = hdr[i + 3];
+            hdr[i + 3] = tmp;
+            tmp = hdr[i + 1];
+            hdr[i + 1] = hdr[i + 2];
+            hdr[i + 2] = tmp;
+        }
+    } else {
+        return FR_NO_FILE; //not a rom image
+    }
+
+    return 0;
+}
+
+//developer override in the header first, then save_db.txt rules in file order
+void romlibDetectSave(RomInfo *inf) {
+
+    u8 val = 0xFF;
+    u32 id = inf->game_id[1] << 8 | inf->game_id[2];
+
+    if (inf->game_id[1] == 'E' && inf->game_id[2] == 'D') {
+        val = inf->version;
+    } else {
+        for (u32 i = 0; i < rl_rule_count; i++) {
+            if (rl_rules[i].key == (rl_rules[i].by_crc ? inf->crc1 : id)) {
+                val = rl_rules[i].val;
+                break;
+            }
+        }
+    }
+
+    if (val == 0xFF) {
+        inf->save = ROM_SAVE_UNKNOWN;
+        inf->cfg = 0;
+    } else {
+        inf->save = val >> 4;
+        inf->cfg = val & 15;
+    }
+}
+
+u8 romlibAddRom(ENTINFO *fi, u32 *budget) {
+
+    RomInfo inf;
+    UINT bw;
+    u8 hdr[0x40];
+    u8 resp;
+
+    if (romlibOldFind(fi, &inf) != 0) {
+
+        *budget = *budget > ROMLIB_HDR_COST ? *budget - ROMLIB_HDR_COST : 0;
+        memset(&inf, 0, sizeof (inf));
+        if (romlibReadHeader(hdr, &inf.order) != 0)return 0; //unreadable or not a rom, skip it
+
+        inf.size = fi->fsize;
+        inf.mtime = (u32) fi->fdate << 16 | fi->ftime;
+        inf.crc1 = (u32) hdr[0x10] << 24 | hdr[0x11] << 16 | hdr[0x12] << 8 | hdr[0x13];
+        inf.crc2 = (u32) hdr[0x14] << 24 | hdr[0x15] << 16 | hdr[0x16] << 8 | hdr[0x17];
+        memcpy(inf.title, &hdr[0x20], sizeof (inf.title));
+        memcpy(inf.game_id, &hdr[0x3B], sizeof (inf.game_id));
+        inf.version = hdr[0x3F];
+        romlibDetectSave(&inf);
+    }
+
+    inf.path_len = strlen(rl_path);
+    inf.rsv = 0;
+
+    resp = f_write(&rl_out, &inf, sizeof (inf), &bw);
+    if (resp == 0)resp = f_write(&rl_out, rl_path, inf.path_len + 1, &bw);
+    if (resp)return resp;
+
+    rl_count++;
+
+    return 0;
+}
+
+u8 romlibFinish() {
+
+    RomLibHdr hdr;
+    UINT bw;
+    u8 resp;
+
+    if (rl_old_open)f_close(&rl_old);
+    rl_old_open = 0;
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.magic = ROMLIB_MAGIC;
+    hdr.count = rl_count;
+
+    resp = f_lseek(&rl_out, 0);
+    if (resp == 0)resp = f_write(&rl_out, &hdr, sizeof (hdr), &bw);
+    if (resp)return resp;
+    resp = f_close(&rl_out);
+    rl_state = RL_DONE;
+    rl_total = rl_count;
+
+    if (resp == 0) {
+        resp = f_unlink(ROMLIB_FILE);
+        if (resp == FR_NO_FILE)resp = 0;
+    }
+    if (resp == 0)resp = f_rename(ROMLIB_TMP, ROMLIB_FILE);
+    if (resp)f_unlink(ROMLIB_TMP);
+
+    return 0;
+}
+
+u8 romlibHexVal(u8 c) {
+
+    if (c >= '0' && c <= '9')return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')return c - 'a' + 10;
+    return 0xFF;
+}
+
+//"0xCRC1=XY" or "ID=XY", anything after XY is a comment. separator lines are skipped
+void romlibParseRule(u8 *line) {
+
+    RomRule *rule = &rl_rules[rl_rule_count];
+    u8 hi, lo;
+
+    while (*line == ' ' || *line == '\t')line++;
+
+    if (line[0] == '0' && (line[1] | 0x20) == 'x') {
+        rule->by_crc = 1;
+        rule->key = 0;
+        line += 2;
+        for (int i = 0; i < 8; i++, line++) {
+            if (romlibHexVal(*line) == 0xFF)return;
+            rule->key = rule->key << 4 | romlibHexVal(*line);
+        }
+    } else {
+        if (line[0] <= ' ' || line[0] == '-' || line[1] <= ' ')return;
+        rule->by_crc = 0;
+        rule->key = line[0] << 8 | line[1];
+        line += 2;
+    }
+
+    while (*line == ' ' || *line == '\t')line++;
+    if (*line++ != '=')return;
+    while (*line == ' ' || *line == '\t')line++;
+
+    hi = romlibHexVal(line[0]);
+    lo = romlibHexVal(line[1]);
+    if (hi > 9 || lo > 9)return;
+    rule->val = hi << 4 | lo;
+
+    rl_rule_count++;
+}
+
+//save_db.txt is small and read once when the indexer starts
+void romlibLoadDb() {
+
+    FIL f;
+    UINT br;
+    u8 buff[512];
+    u8 line[64];
+    u32 len = 0;
+    u8 c;
+
+    rl_rule_count = 0;
+    if (f_open(&f, ROMLIB_SAVE_DB, FA_READ) != FR_OK)return;
+
+    while (rl_rule_count < ROMLIB_DB_RULES) {
+
+        if (f_read(&f, buff, sizeof (buff), &br) != FR_OK)br = 0;
+
+        for (u32 i = 0; i <= br && rl_rule_count < ROMLIB_DB_RULES; i++) {
+
+            c = i < br ? buff[i] : '\n';
+            if (c != '\n' && c != '\r') {
+                if (len < sizeof (line) - 1)line[len++] = c;
+                continue;
+            }
+            line[len] = 0;
+            if (len)romlibParseRule(line);
+            len = 0;
+        }
+
+        if (br < sizeof (buff))break;
+    }
+
+    f_close(&f);
+}
+
+u8 romlibOpen(FIL *f, u32 *count) {
+
+    RomLibHdr hdr;
+    UINT br;
+    u8 resp;
+
+    resp = f_open(f, ROMLIB_FILE, FA_READ);
+    if (resp)return resp;
+
+    resp = f_read(f, &hdr, sizeof (hdr), &br);
+    if (resp == 0 && (br != sizeof (hdr) || hdr.magic != ROMLIB_MAGIC))resp = FR_NO_FILE;
+    if (resp) {
+        f_close(f);
+        return resp;
+    }
+
+    *count = hdr.count;
+
+    return 0;
+}
+
+//reads the next record. path is cut to path_max - 1 characters
+u8 romlibNext(FIL *f, RomInfo *inf, u8 *path, u32 path_max) {
+
+    UINT br;
+    u8 resp;
+    u32 len;
+
+    resp = f_read(f, inf, sizeof (RomInfo), &br);
+    if (resp)return resp;
+    if (br != sizeof (RomInfo))return FR_NO_FILE;
+
+    len = inf->path_len + 1;
+    if (len > path_max)len = path_max;
+
+    resp = f_read(f, path, len, &br);
+    if (resp)return resp;
+    if (br != len)return FR_NO_FILE;
+    path[len - 1] = 0;
+
+    return f_lseek(f, f_tell(f) + inf->path_len + 1 - len);
+}
+
+//index record of the rom file. FR_NO_FILE if the rom is not in the index
+u8 romlibFind(u8 *path, RomInfo *inf) {
+
+    u8 name[ROMLIB_PATH_LEN];
+    FIL f;
+    u32 count;
+    u8 resp;
+
+    resp = romlibOpen(&f, &count);
+    if (resp)return resp;
+
+    resp = FR_NO_FILE;
+    for (u32 i = 0; i < count; i++) {
+        if (romlibNext(&f, inf, name, sizeof (name)))break;
+        if (strcmp(name, path) == 0) {
+            resp = 0;
+            break;
+        }
+    }
+
+    f_close(&f);
+
+    return resp;
+}
@@ -0,0 +1,445 @@
+#include "everdrive.h"
+
+//backup ram read of the next dump chunk, done while the card programs the current one
+typedef struct {
+    u8 *dst;
+    u32 addr;
+    u32 len;
+    u32 pos;
+} SaveRead;
+
+void saveReadTask();
+u32 saveHash(void *page);
+void saveHashBrm(u32 *page_hash, u32 size);
+u8 saveFill(u32 pos, u32 size, u8 val);
+u8 saveMakePath(u8 *dst, u8 *rom_path, u8 type);
+u32 saveTagSum(SaveTag *tag);
+void saveTagClear();
+
+u64 sv_buff[SAVE_CHUNK / 8];
+SaveRead sv_read;
+u8 sv_flushed;
+u32 sv_written; //bytes written by the last flush
+u32 sv_skipped; //unchanged bytes which were not written
+
+u32 saveSize(u8 type) {
+
+    switch (type) {
+        case SAVE_SRM32K:
+            return 0x8000;
+        case SAVE_SRM96K:
+            return 0x18000;
+        case SAVE_FLASH:
+        case SAVE_SRM128K:
+            return 0x20000;
+    }
+
+    return 0; //eeprom is not in backup ram
+}
+
+//sets save type of the rom and loads its save file to backup ram.
+//type comes from the rom library, roms which are not indexed yet use eeprom 16k.
+//disk_path is the 64DD image a loader put in rom memory at disk_addr, 0 for cartridge games
+u8 saveStart(u8 *rom_path, u32 rom_size, u8 *disk_path, u32 disk_addr, u32 disk_size) {
+
+    RomInfo inf;
+    FILINFO fi;
+    SaveTag *tag = (SaveTag *) sv_buff;
+    u8 path[SAVE_PATH_LEN];
+    u32 page_hash[SAVE_PAGES];
+    u8 hashed = 0;
+    u8 type = SAVE_EEP16K;
+    u8 resp;
+    u8 tagged = rom_size <= SAVE_STAGE_ADDR - BI_ADDR_ROM;
+
+    //image must end below the stage, the tag is not written over it
+    if (disk_path) {
+        if (strlen(disk_path) >= SAVE_PATH_LEN)return FR_INVALID_NAME;
+        if ((disk_addr & (BI_DD_PGE_SIZE - 1)) || disk_addr < BI_ADDR_ROM || disk_addr >= SAVE_STAGE_ADDR)return FR_INVALID_PARAMETER;
+        if (disk_size > SAVE_STAGE_ADDR - disk_addr)return FR_INVALID_PARAMETER;
+    }
+
+    if (romlibFind(rom_path, &inf) == 0 && inf.save != ROM_SAVE_UNKNOWN)type = inf.save;
+
+    bi_game_cfg_set(disk_path ? type | SAVE_DD64 : type);
+    if (tagged)saveTagClear(); //huge roms fill the tag area, it is a part of the game
+    if (disk_path)bi_dd_tbl_clr(); //pages written by the loader are in the file already
+
+    path[0] = 0;
+    if (saveSize(type) != 0 && saveMakePath(path, rom_path, type) == 0) {
+
+        resp = f_mkdir(SAVE_DIR);
+        if (resp && resp != FR_EXIST)return resp;
+
+        resp = saveRestore(path, type);
+        if (resp)return resp;
+    }
+
+    //eeprom games and saves without room for the name have nothing to write back
+    if (path[0] == 0 && disk_path == 0)return 0;
+
+    //tag area is the last part of the rom space. huge roms go without backup on reset
+    if (!tagged)return 0;
+
+    //pages are compared on flush only if the file holds the whole backup ram
+    if (path[0]) {
+        hashed = f_stat(path, &fi) == 0 && fi.fsize == saveSize(type);
+        if (hashed)saveHashBrm(page_hash, saveSize(type));
+    }
+
+    memset(tag, 0, sizeof (SaveTag));
+    tag->magic = SAVE_TAG_MAGIC;
+    tag->type = path[0] ? type : SAVE_OFF;
+    strcpy(tag->path, path);
+    if (hashed) {
+        tag->hashed = 1;
+        memcpy(tag->page_hash, page_hash, sizeof (page_hash));
+    }
+    if (disk_path) {
+        tag->disk_addr = disk_addr;
+        strcpy(tag->disk_path, disk_path);
+    }
+    tag->sum = saveTagSum(tag);
+    sysPI_wr(tag, SAVE_TAG_ADDR, sizeof (SaveTag));
+
+    return 0;
+}
+
+//writes backup ram and 64DD disk of the last game to their files. called once at menu start.
+//tag is lost with the cart memory on power off, so cart memory is not trusted without it
+u8 saveBackup() {
+
+    SaveTag tag;
+    u8 resp = 0;
+
+    sysPI_rd(sv_buff, SAVE_TAG_ADDR, sizeof (SaveTag));
+    memcpy(&tag, sv_buff, sizeof (SaveTag));
+    if (tag.magic != SAVE_TAG_MAGIC || tag.sum != saveTagSum(&tag))return 0;
+    tag.path[SAVE_PATH_LEN - 1] = 0;
+    tag.disk_path[SAVE_PATH_LEN - 1] = 0;
+
+    if (saveSize(tag.type) != 0) {
+        bi_game_cfg_set(tag.type);
+        if (tag.hashed) {
+            resp = saveFlush(tag.path, tag.type, tag.page_hash);
+        } else {
+            resp = saveDump(tag.path, tag.type);
+        }
+        bi_game_cfg_set(SAVE_OFF);
+    }
+    if (resp == 0 && tag.disk_addr != 0) {
+        resp = saveDiskFlush(tag.disk_path, tag.disk_addr);
+    }
+    if (resp)return resp; //tag stays, next start tries again
+
+    saveTagClear();
+
+    return 0;
+}
+
+//disk dma can't write to backup ram, so the file is read to ram and written from there.
+//reading through a rom stage is slower: disk dma and backup ram can't share the PI bus, and
+//the stage costs one more copy
+u8 saveRestore(u8 *path, u8 type) {
+
+    FIL f;
+    UINT br;
+    u8 resp;
+    u32 len;
+    u32 pos = 0;
+    u32 chunk;
+    u32 size = saveSize(type);
+    u8 erased = type == SAVE_FLASH ? 0xFF : 0x00;
+
+    resp = f_open(&f, path, FA_READ);
+    if (resp == FR_NO_FILE)return saveFill(0, size, erased); //new game
+    if (resp)return resp;
+
+    len = f_size(&f) < size ? f_size(&f) : size;
+    len &= ~1; //PI DMA works with halfwords
+
+    while (pos < len) {
+
+        chunk = len - pos;
+        if (chunk > SAVE_CHUNK)chunk = SAVE_CHUNK;
+
+        resp = f_read(&f, sv_buff, chunk, &br);
+        if (resp || br != chunk)break;
+
+        sysPI_wr(sv_buff, BI_ADDR_BRM + pos, chunk);
+        pos += chunk;
+    }
+
+    f_close(&f);
+    if (resp)return resp;
+
+    return saveFill(pos, size, erased);
+}
+
+//sd writes are driven by cpu from ram, so backup ram goes to disk through the two halves of sv_buff.
+//one half is written to the file, the next chunk is read to the other one while the card is busy
+u8 saveDump(u8 *path, u8 type) {
+
+    FIL f;
+    UINT bw;
+    u8 resp;
+    u32 chunk;
+    u32 size = saveSize(type);
+    u8 *buff = (u8 *) sv_buff;
+    u32 half = 0;
+
+    if (size == 0)return 0;
+
+    resp = f_open(&f, path, FA_WRITE | FA_OPEN_ALWAYS);
+    if (resp)return resp;
+
+    sysPI_rd(buff, BI_ADDR_BRM, SAVE_CHUNK / 2);
+
+    for (u32 pos = 0; pos < size && resp == 0; pos += chunk) {
+
+        chunk = size - pos;
+        if (chunk > SAVE_CHUNK / 2)chunk = SAVE_CHUNK / 2;
+
+        sv_read.dst = &buff[half ^ SAVE_CHUNK / 2];
+        sv_read.addr = BI_ADDR_BRM + pos + chunk;
+        sv_read.len = size - pos - chunk;
+        if (sv_read.len > SAVE_CHUNK / 2)sv_read.len = SAVE_CHUNK / 2;
+        sv_read.pos = 0;
+
+        bi_sd_idle(saveReadTask);
+        resp = f_write(&f, &buff[half], chunk, &bw);
+        bi_sd_idle(0);
+        if (resp == 0 && bw != chunk)resp = FR_DENIED; //disk full
+
+        while (sv_read.pos < sv_read.len)saveReadTask();
+        half ^= SAVE_CHUNK / 2;
+    }
+
+    if (resp == 0)resp = f_truncate(&f);
+    if (resp) {
+        f_close(&f);
+        return resp;
+    }
+
+    sv_flushed = 1;
+    sv_written = size;
+    sv_skipped = 0;
+
+    return f_close(&f);
+}
+
+//rewrites only the pages of the save file which differ from the restored ones.
+//runs of changed pages go out as one multi-block write, the file is updated in place
+u8 saveFlush(u8 *path, u8 type, u32 *page_hash) {
+
+    FIL f;
+    UINT bw;
+    u8 resp;
+    u32 len;
+    u32 written = 0;
+    u32 size = saveSize(type);
+    u8 *buff = (u8 *) sv_buff;
+
+    resp = f_open(&f, path, FA_WRITE | FA_OPEN_EXISTING);
+    if (resp == FR_NO_FILE)return saveDump(path, type);
+    if (resp)return resp;
+    if (f_size(&f) != size) {
+        f_close(&f);
+        return saveDump(path, type);
+    }
+
+    for (u32 pos = 0; pos < size && resp == 0; pos += SAVE_CHUNK) {
+
+        sysPI_rd(sv_buff, BI_ADDR_BRM + pos, SAVE_CHUNK);
+
+        for (u32 u = 0; u < SAVE_CHUNK && resp == 0; u += len + SAVE_PAGE) {
+
+            for (len = 0; u + len < SAVE_CHUNK; len += SAVE_PAGE) {
+                if (saveHash(&buff[u + len]) == page_hash[(pos + u + len) / SAVE_PAGE])break;
+            }
+            if (len == 0)continue;
+
+            if (f_tell(&f) != pos + u)resp = f_lseek(&f, pos + u);
+            if (resp == 0)resp = f_write(&f, &buff[u], len, &bw);
+            if (resp == 0 && bw != len)resp = FR_DENIED;
+            written += len;
+        }
+    }
+
+    if (resp) {
+        f_close(&f);
+        return resp;
+    }
+
+    sv_flushed = 1;
+    sv_written = written;
+    sv_skipped = size - written;
+
+    return f_close(&f);
+}
+
+//bytes written and skipped by the flush at menu start. returns 0 if there was no flush
+u8 saveStat(u32 *written, u32 *skipped) {
+
+    *written = sv_written;
+    *skipped = sv_skipped;
+
+    return sv_flushed;
+}
+
+//writes back only the 32K pages of the 64DD image which were modified by the game.
+//runs of dirty pages go out as sequential multi-block writes without seeks between them
+u8 saveDiskFlush(u8 *path, u32 addr) {
+
+    u64 buff[BI_DD_TBL_SIZE / 8];
+    u8 *tbl = (u8 *) buff;
+    FIL f;
+    UINT bw;
+    u8 resp;
+    u32 ofs;
+    u32 len;
+    u32 chunk;
+    u32 first = (addr - BI_ADDR_ROM) / BI_DD_PGE_SIZE;
+
+    bi_dd_tbl_rd(buff);
+
+    resp = f_open(&f, path, FA_WRITE | FA_OPEN_EXISTING);
+    if (resp)return resp;
+
+    for (u32 i = first; i < BI_DD_TBL_SIZE && resp == 0; i++) {
+
+        if (tbl[i] == 0)continue;
+
+        ofs = (i - first) * BI_DD_PGE_SIZE;
+        if (ofs >= f_size(&f))break;
+        len = f_size(&f) - ofs;
+        if (len > BI_DD_PGE_SIZE)len = BI_DD_PGE_SIZE;
+
+        if (f_tell(&f) != ofs)resp = f_lseek(&f, ofs);
+
+        for (u32 u = 0; u < len && resp == 0; u += chunk) {
+            chunk = len - u;
+            if (chunk > SAVE_CHUNK)chunk = SAVE_CHUNK;
+            sysPI_rd(sv_buff, addr + ofs + u, (chunk + 1) & ~1);
+            resp = f_write(&f, sv_buff, chunk, &bw);
+            if (resp == 0 && bw != chunk)resp = FR_DENIED;
+        }
+    }
+
+    if (resp) {
+        f_close(&f);
+        return resp;
+    }
+
+    resp = f_close(&f);
+    if (resp)return resp;
+
+    bi_dd_tbl_clr();
+
+    return 0;
+}
+
+//called while the card programs a written block. reads a part of the next chunk from backup ram
+void saveReadTask() {
+
+    u32 len = sv_read.len - sv_read.pos;
+
+    if (len == 0)return;
+    if (len > SAVE_READ_STEP)len = SAVE_READ_STEP;
+
+    sysPI_rd(&sv_read.dst[sv_read.pos], sv_read.addr + sv_read.pos, len);
+    sv_read.pos += len;
+}
+
+//rest of the backup ram after the end of the save file
+u8 saveFill(u32 pos, u32 size, u8 val) {
+
+    u32 chunk;
+
+    memset(sv_buff, val, sizeof (sv_buff));
+
+    while (pos < size) {
+        chunk = size - pos;
+        if (chunk > SAVE_CHUNK)chunk = SAVE_CHUNK;
+        sysPI_wr(sv_buff, BI_ADDR_BRM + pos, chunk);
+        pos += chunk;
+    }
+
+    return 0;
+}
+
+//SAVE_DIR/<rom name without extension>.srm, .fla for flash
+u8 saveMakePath(u8 *dst, u8 *rom_path, u8 type) {
+
+    u8 *name = rom_path;
+    u32 len;
+
+    for (u8 *ptr = rom_path; *ptr; ptr++) {
+        if (*ptr == '/')name = ptr + 1;
+    }
+
+    len = strlen(name);
+    for (u32 i = len; i > 0; i--) {
+        if (name[i - 1] == '.') {
+            len = i - 1;
+            break;
+        }
+    }
+
+    if (sizeof (SAVE_DIR) + len + 5 > SAVE_PATH_LEN)return 1;
+
+    strcpy(dst, SAVE_DIR "/");
+    dst += sizeof (SAVE_DIR);
+    memcpy(dst, name, len);
+    strcpy(&dst[len], type == SAVE_FLASH ? ".fla" : ".srm");
+
+    return 0;
+}
+
+u32 saveTagSum(SaveTag *tag) {
+
+    u32 sum = tag->magic + tag->type + tag->disk_addr + tag->hashed;
+
+    for (u32 i = 0; i < SAVE_PATH_LEN && tag->path[i]; i++) {
+        sum = sum * 31 + tag->path[i];
+    }
+    for (u32 i = 0; i < SAVE_PATH_LEN && tag->disk_path[i]; i++) {
+        sum = sum * 31 + tag->disk_path[i];
+    }
+    for (u32 i = 0; i < SAVE_PAGES; i++) {
+        sum = sum * 31 + tag->page_hash[i];
+    }
+
+    return sum;
+}
+
+void saveTagClear() {
+
+    memset(sv_buff, 0, sizeof (SaveTag));
+    sysPI_wr(sv_buff, SAVE_TAG_ADDR, sizeof (SaveTag));
+}
+
+//FNV-1a over the words of the page
+u32 saveHash(void *page) {
+
+    u32 *ptr = (u32 *) page;
+    u32 hash = 0x811C9DC5;
+
+    for (u32 i = 0; i < SAVE_PAGE / 4; i++) {
+        hash = (hash ^ ptr[i]) * 0x01000193;
+    }
+
+    return hash;
+}
+
+void saveHashBrm(u32 *page_hash, u32 size) {
+
+    u8 *buff = (u8 *) sv_buff;
+
+    for (u32 pos = 0; pos < size; pos += SAVE_CHUNK) {
+        sysPI_rd(sv_buff, BI_ADDR_BRM + pos, SAVE_CHUNK);
+        for (u32 u = 0; u < SAVE_CHUNK; u += SAVE_PAGE) {
+            page_hash[(pos + u) / SAVE_PAGE] = saveHash(&buff[u]);
+        }
+    }
+}
@@ -189,6 +189,27 @@ void sysPI_wr(void *ram, unsigned long pi_address, unsigned long len) {
 
 }
 
+//hash of SYS_HASH_SAMPLES blocks spread over the range. checks that a loaded image is still in memory
+u32 sysHashPI(u32 pi_address, u32 len) {
+
+    u64 buff[SYS_HASH_BLOCK / 8];
+    u32 *ptr = (u32 *) buff;
+    u32 hash = 0x811C9DC5;
+    u32 addr;
+
+    for (u32 i = 0; i < SYS_HASH_SAMPLES; i++) {
+
+        addr = ((u64) (len - SYS_HASH_BLOCK) * i / (SYS_HASH_SAMPLES - 1)) & ~7;
+        sysPI_rd(buff, pi_address + addr, SYS_HASH_BLOCK);
+
+        for (u32 u = 0; u < SYS_HASH_BLOCK / 4; u++) {
+            hash = (hash ^ ptr[u]) * 0x01000193;
+        }
+    }
+
+    return hash;
+}
+
 //****************************************************************************** gfx
 u16 *g_disp_ptr;
 u16 g_cur_pal;
@@ -259,6 +280,17 @@ void gVsync() {
     while (vregs[4] != 0x200);
 }
 
+//non-blocking gVsync for polling loops. returns 1 once per frame, when the current line wrapped since the last call
+u8 gVsyncPoll() {
+
+    static u32 line;
+    u32 cur = vregs[4];
+    u8 frame = cur < line;
+
+    line = cur;
+    return frame;
+}
+
 
 void gAppendHex4(u8 val);
 
@@ -308,6 +340,20 @@ void gAppendHex32(u32 val) {
 
 }
 
+void gAppendNum(u32 num) {
+
+    u8 buff[11];
+    u8 *ptr = &buff[sizeof (buff) - 1];
+
+    *ptr = 0;
+    do {
+        *--ptr = '0' + num % 10;
+        num /= 10;
+    } while (num);
+
+    gAppendString(ptr);
+}
+
 void gSetXY(u8 x, u8 y) {
 
     g_cons_ptr = x + y * G_SCREEN_W;
@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.IO;
 using System.Linq;
 using System.Text;
@@ -14,6 +15,41 @@ namespace ed64usb
         public const string MINIMUM_OS_VERSION = "3.05";
         public const int MAX_ROM_SIZE = 0x4000000;
         public const int MIN_ROM_SIZE = 0x101000;
+        public const int CRC_AREA_SIZE = 0x100000 + 4096; //smaller ROMs are padded, the boot code checks the CRC of this area
+        public const int TRANSFER_CHUNK_SIZE = 0x10000; //framed transfers are CRC checked per chunk
+        public const int MAX_RETRANSMIT = 3;
+        public const uint LZ_STORED = 0x80000000; //compressed chunk frame holds raw data
+        public const uint RAM_WRITE_ICACHE = 1; //invalidate the instruction cache over the written range
+
+        [Flags]
+        public enum Capabilities : uint
+        {
+            None = 0,
+            ChunkCrc = 1, //framed ROM write 'X'
+            Resume = 2, //transfer query 'q'
+            Lz = 4, //compressed ROM write 'Z'
+            Hash = 8, //ROM chunk hashes 'h' and upload record 'H'
+            RamWrite = 16, //RAM write 'w', also served by programs which call usbService
+            FileWrite = 32 //SD card file write 'F'
+        }
+
+        /// <summary>
+        /// Protocol version of the cartridge, 1 if it does not support version negotiation
+        /// </summary>
+        public static int ProtocolVersion { get; private set; } = 1;
+        public static Capabilities DeviceCapabilities { get; private set; } = Capabilities.None;
+        private static int transferWindow = TRANSFER_CHUNK_SIZE;
+        private static uint logDropped = 0;
+
+        /// <summary>
+        /// Compress ROM uploads when the cartridge supports it
+        /// </summary>
+        public static bool Compression { get; set; } = true;
+
+        /// <summary>
+        /// Send only the chunks which differ from the ROM memory of the cartridge
+        /// </summary>
+        public static bool Delta { get; set; } = true;
 
         private enum TransmitCommand : byte
         {
@@ -22,9 +58,16 @@ namespace ed64usb
             RomWrite = (byte)'W', // char ROM 'W' rite
             RomStart = (byte)'s', //char ROM 's' tart
             TestConnection = (byte)'t', //char 't' est
+            ProtocolVersion = (byte)'v', //char protocol 'v' ersion
+            RomWriteFramed = (byte)'X', //char ROM write, CRC checked
+            RomWriteCompressed = (byte)'Z', //char ROM write, LZ4 compressed and CRC checked
+            RomHash = (byte)'h', //char ROM chunk 'h' ashes
+            RomRecord = (byte)'H', //char ROM upload record, after the last chunk
+            TransferQuery = (byte)'q', //char transfer 'q' uery
 
             RamRead = (byte)'r', //char RAM 'r' ead
-            //RamWrite = (byte)'w', //char RAM 'w' rite
+            RamWrite = (byte)'w', //char RAM 'w' rite
+            FileWrite = (byte)'F', //char SD card 'F' ile write
             FpgaWrite = (byte)'f' //char 'f' pga write
 
         }
@@ -33,6 +76,7 @@ namespace ed64usb
         {
             CommsReply = (byte)'r',
             CommsReplyLegacy = (byte)'k',
+            LogFrame = (byte)'l', //debug log text of usbLogFlush, may arrive before any reply
 
         }
 
@@ -191,7 +235,10 @@ namespace ed64usb
 
                         var fillValue = IsBootLoader(romBytes.ToArray()) ? 0xffffffff : 0;
 
-                        FillCartridgeRomSpace(romBytes.ToArray().Length, fillValue);
+                        if ((DeviceCapabilities & Capabilities.Hash) == 0)
+                        {
+                            FillCartridgeRomSpace(romBytes.ToArray().Length, fillValue);
+                        }
 
                         //we can deal with save types, RTC and region here!
                         if (saveType != DeveloperRom.SaveType.None)
@@ -204,7 +251,7 @@ namespace ed64usb
 
                         //Loading a ROM generated with 'makemask' over USB less than 1MB in size doesn't seem to like `0xff` padding. 
                         //Lets remove them as a workaround!
-                        for (int i = romBytes.Count; i > 0; i--) //cycle backwards through the byte array
+                        for (int i = romBytes.Count - 1; i > 0; i--) //cycle backwards through the byte array
                         {
                             if (romBytes[i] == 0xff)
                             {
@@ -212,10 +259,21 @@ namespace ed64usb
                             }
                             else //break on first chance.
                             {
-                                return;
+                                break;
                             }
                         }
 
+                        while (romBytes.Count % 512 != 0) //the cartridge receives whole 512 byte blocks
+                        {
+                            romBytes.Add(0);
+                        }
+
+                        //the fill is part of the image, so that delta uploads compare it like the rest of the ROM
+                        while ((DeviceCapabilities & Capabilities.Hash) != 0 && romBytes.Count < CRC_AREA_SIZE)
+                        {
+                            romBytes.Add((byte)fillValue);
+                        }
+
                         RomWrite(romBytes.ToArray(), baseAddress);
                     }
                 }
@@ -261,6 +319,87 @@ namespace ed64usb
             return data;
         }
 
+        /// <summary>
+        /// Writes to the console RAM. The USB loader or a program which calls usbService must be running
+        /// </summary>
+        /// <param name="data">The data to write</param>
+        /// <param name="startAddress">The start address (KSEG0 or KSEG1)</param>
+        /// <param name="code">The data is code, the instruction cache is invalidated</param>
+        public static void RamWrite(byte[] data, uint startAddress, bool code)
+        {
+            if ((DeviceCapabilities & Capabilities.RamWrite) == 0)
+            {
+                throw new Exception("RAM writes are not supported by the program on the console.");
+            }
+            if (data.Length % 4 != 0 || startAddress % 4 != 0)
+            {
+                throw new Exception("RAM writes must be a multiple of 4 bytes at an address aligned to 4 bytes.");
+            }
+
+            CommandPacketTransmitBytes(TransmitCommand.RamWrite, startAddress, (uint)data.Length, code ? RAM_WRITE_ICACHE : 0);
+
+            UsbInterface.ProgressBarTimerInterval = data.Length > 0x200000 ? 0x100000 : 0x80000;
+            var time = DateTime.UtcNow.Ticks;
+            UsbInterface.Write(data);
+            var responseBytes = CommandPacketReceive();
+            time = DateTime.UtcNow.Ticks - time;
+
+            if (responseBytes[4] != 0)
+            {
+                throw new Exception($"RAM write error: 0x{BitConverter.ToString(new byte[] { responseBytes[4] })}");
+            }
+
+            Console.WriteLine($"OK. {data.Length} bytes in {time / 10000} ms");
+        }
+
+        /// <summary>
+        /// Writes a file to the SD card of the cartridge, existing files are replaced
+        /// </summary>
+        /// <param name="filename">The file to upload</param>
+        /// <param name="sdPath">The path on the SD card, folders must exist</param>
+        public static void FileWrite(string filename, string sdPath)
+        {
+            if ((DeviceCapabilities & Capabilities.FileWrite) == 0)
+            {
+                throw new Exception("The cartridge does not support SD card uploads.");
+            }
+
+            sdPath = sdPath.Replace('\\', '/');
+            var path = Encoding.ASCII.GetBytes(sdPath);
+            if (path.Length > 511 || Encoding.ASCII.GetString(path) != sdPath)
+            {
+                throw new Exception("The SD card path must be ASCII and shorter than 512 characters.");
+            }
+
+            var data = File.ReadAllBytes(filename);
+            var pathBlock = new byte[512];
+            Array.Copy(path, pathBlock, path.Length);
+
+            CommandPacketTransmitBytes(TransmitCommand.FileWrite, 0, (uint)data.Length, 0);
+            UsbInterface.Write(pathBlock);
+
+            UsbInterface.ProgressBarTimerInterval = 0x100000;
+            var time = DateTime.UtcNow.Ticks;
+            UsbInterface.Write(data);
+            if (data.Length % 512 != 0)
+            {
+                UsbInterface.Write(new byte[512 - data.Length % 512]);
+            }
+            var responseBytes = CommandPacketReceive();
+            time = DateTime.UtcNow.Ticks - time;
+
+            if (responseBytes[4] != 0)
+            {
+                throw new Exception($"SD card write error (FatFs result {responseBytes[4]}).");
+            }
+            if (FromBigEndian(responseBytes, 12) != Crc32.Compute(data, 0, data.Length))
+            {
+                throw new Exception("The file on the SD card does not match, the upload was corrupted.");
+            }
+
+            Console.WriteLine($"OK. speed: {GetSpeedString(data.Length, time)}");
+        }
+
         /// <summary>
         /// Writes to the cartridge ROM
         /// </summary>
@@ -269,6 +408,14 @@ namespace ed64usb
         /// <returns></returns>
         private static byte[] RomWrite(byte[] data, uint startAddress)
         {
+            if ((DeviceCapabilities & Capabilities.ChunkCrc) != 0)
+            {
+                var sent = 0L;
+                var written = 0L;
+                var framedTime = RomWriteFramed(data, startAddress, ref sent, ref written);
+                PrintWriteSpeed(framedTime, sent, written);
+                return data;
+            }
 
             var length = data.Length;
 
@@ -284,6 +431,344 @@ namespace ed64usb
             return data;
         }
 
+        /// <summary>
+        /// Writes to the cartridge ROM in windows of CRC checked chunks.
+        /// Chunks with a bad CRC are sent again, chunks already received by an interrupted run of the same transfer are skipped.
+        /// </summary>
+        /// <param name="data">The data to write</param>
+        /// <param name="startAddress">The start address</param>
+        /// <param name="sent">Incremented by the bytes sent over USB</param>
+        /// <param name="written">Incremented by the bytes written to ROM</param>
+        /// <param name="incremental">Skip the chunks the cartridge already has, from an interrupted transfer or an earlier upload</param>
+        /// <returns>The time spent sending the chunks, in ticks</returns>
+        private static long RomWriteFramed(byte[] data, uint startAddress, ref long sent, ref long written, bool incremental = true)
+        {
+            var chunkCount = (data.Length + TRANSFER_CHUNK_SIZE - 1) / TRANSFER_CHUNK_SIZE;
+            var chunkCrcs = new uint[chunkCount];
+            for (int i = 0; i < chunkCount; i++)
+            {
+                var offset = i * TRANSFER_CHUNK_SIZE;
+                chunkCrcs[i] = Crc32.Compute(data, offset, Math.Min(TRANSFER_CHUNK_SIZE, data.Length - offset));
+            }
+
+            //the id is the same for the same data at the same address, so a rerun after an interruption resumes
+            var idBytes = new List<byte>();
+            idBytes.AddRange(ToBigEndian(startAddress));
+            idBytes.AddRange(ToBigEndian((uint)data.Length));
+            foreach (var crc in chunkCrcs)
+            {
+                idBytes.AddRange(ToBigEndian(crc));
+            }
+            var transferId = Crc32.Compute(idBytes.ToArray(), 0, idBytes.Count);
+
+            //hashes show what the rom holds now, the resume marks are only used when there are no hashes
+            var hashes = HashCache.Compute(data, TRANSFER_CHUNK_SIZE);
+            var unchanged = incremental && Delta && (DeviceCapabilities & Capabilities.Hash) != 0 ? RomHashQuery(startAddress, data.Length, hashes) : null;
+            var done = incremental && (DeviceCapabilities & Capabilities.Resume) != 0 ? TransferQuery(transferId) : null;
+
+            var pending = new List<int>();
+            for (int i = 0; i < chunkCount; i++)
+            {
+                if (unchanged != null ? unchanged[i] : IsChunkDone(done, startAddress, i)) continue;
+                pending.Add(i);
+            }
+            if (pending.Count < chunkCount)
+            {
+                Console.Write($"{chunkCount - pending.Count} of {chunkCount} chunks already on the cartridge...");
+            }
+
+            var frames = Compression && (DeviceCapabilities & Capabilities.Lz) != 0 ? new byte[chunkCount][] : null; //compressed when first sent
+            var time = DateTime.UtcNow.Ticks;
+            for (int attempt = 0; pending.Count != 0; attempt++)
+            {
+                if (attempt > MAX_RETRANSMIT)
+                {
+                    throw new Exception($"USB transfer error: {pending.Count} chunks failed the CRC check.");
+                }
+                if (attempt != 0)
+                {
+                    Console.Write($"CRC error in {pending.Count} chunks, retrying...");
+                }
+
+                try
+                {
+                    pending = RomWriteChunks(data, startAddress, chunkCrcs, frames, pending, transferId, ref sent, ref written);
+                }
+                catch (TimeoutException)
+                {
+                    throw new Exception("USB transfer interrupted. Run the same command again to resume it.");
+                }
+            }
+            time = DateTime.UtcNow.Ticks - time;
+
+            if ((DeviceCapabilities & Capabilities.Hash) != 0)
+            {
+                CommandPacketTransmitBytes(TransmitCommand.RomRecord, startAddress, (uint)data.Length, transferId);
+                CommandPacketReceive();
+                new HashCache { TransferId = transferId, Address = startAddress, Hashes = hashes }.Save();
+            }
+
+            return time;
+        }
+
+        /// <summary>
+        /// Prints the result of a framed ROM write
+        /// </summary>
+        /// <param name="time">The time returned by RomWriteFramed</param>
+        private static void PrintWriteSpeed(long time, long sent, long written)
+        {
+            if (written == 0)
+            {
+                Console.WriteLine("OK.");
+                return;
+            }
+
+            Console.Write($"OK. speed: {GetSpeedString(written, time)}");
+            Console.WriteLine(Compression && (DeviceCapabilities & Capabilities.Lz) != 0 ? $" ({sent / 1024} KB sent for {written / 1024} KB)" : "");
+        }
+
+        /// <summary>
+        /// Sends runs of consecutive chunks, one window per command
+        /// </summary>
+        /// <param name="frames">Compressed chunk frames, null to send raw data</param>
+        /// <returns>The chunks which failed the CRC check</returns>
+        private static List<int> RomWriteChunks(byte[] data, uint startAddress, uint[] chunkCrcs, byte[][] frames, List<int> chunks, uint transferId, ref long sent, ref long written)
+        {
+            var failed = new List<int>();
+
+            for (int i = 0; i < chunks.Count;)
+            {
+                var first = chunks[i];
+                var count = 1;
+                while (i + count < chunks.Count && chunks[i + count] == first + count && (count + 1) * TRANSFER_CHUNK_SIZE <= transferWindow) count++;
+
+                var offset = first * TRANSFER_CHUNK_SIZE;
+                var length = Math.Min(count * TRANSFER_CHUNK_SIZE, data.Length - offset);
+
+                if (frames != null)
+                {
+                    var window = new List<byte>();
+                    for (int u = first; u < first + count; u++)
+                    {
+                        frames[u] = frames[u] ?? CompressChunk(data, u * TRANSFER_CHUNK_SIZE, Math.Min(TRANSFER_CHUNK_SIZE, data.Length - u * TRANSFER_CHUNK_SIZE), chunkCrcs[u]);
+                        window.AddRange(frames[u]);
+                    }
+
+                    CommandPacketTransmitBytes(TransmitCommand.RomWriteCompressed, startAddress + (uint)offset, (uint)length, transferId);
+                    UsbInterface.ProgressBarTimerInterval = 0x80000;
+                    UsbInterface.Write(window.ToArray());
+                    sent += window.Count;
+                }
+                else
+                {
+                    var crcTable = new byte[512];
+                    for (int u = 0; u < count; u++)
+                    {
+                        Array.Copy(ToBigEndian(chunkCrcs[first + u]), 0, crcTable, u * 4, 4);
+                    }
+
+                    CommandPacketTransmitBytes(TransmitCommand.RomWriteFramed, startAddress + (uint)offset, (uint)length, transferId);
+                    UsbInterface.Write(crcTable);
+                    UsbInterface.ProgressBarTimerInterval = 0x80000;
+                    UsbInterface.Write(data, offset, length);
+                    sent += length + crcTable.Length;
+                }
+                written += length;
+
+                var responseBytes = CommandPacketReceive();
+                if (responseBytes[4] > 1)
+                {
+                    throw new Exception($"USB transfer error: 0x{BitConverter.ToString(new byte[] { responseBytes[4] })}");
+                }
+                var mask = (ulong)FromBigEndian(responseBytes, 8) << 32 | FromBigEndian(responseBytes, 12);
+                for (int u = 0; u < count; u++)
+                {
+                    if ((mask >> u & 1) != 0) failed.Add(first + u);
+                }
+
+                i += count;
+            }
+
+            return failed;
+        }
+
+        /// <summary>
+        /// Builds the frame of a compressed chunk: size, CRC and the LZ4 block, padded to 512 bytes.
+        /// Chunks which would not take fewer blocks compressed are sent raw
+        /// </summary>
+        private static byte[] CompressChunk(byte[] data, int offset, int length, uint crc)
+        {
+            var packed = Lz.Compress(data, offset, length);
+            var stored = (8 + packed.Length + 511) / 512 >= (8 + length + 511) / 512;
+            var size = stored ? length : packed.Length;
+
+            var frame = new byte[(8 + size + 511) / 512 * 512];
+            Array.Copy(ToBigEndian((uint)size | (stored ? LZ_STORED : 0)), 0, frame, 0, 4);
+            Array.Copy(ToBigEndian(crc), 0, frame, 4, 4);
+            Array.Copy(stored ? data : packed, stored ? offset : 0, frame, 8, size);
+
+            return frame;
+        }
+
+        /// <summary>
+        /// Measures the round trip time of the test command
+        /// </summary>
+        /// <param name="count">The number of commands to send</param>
+        public static void RunLatencyBenchmark(int count)
+        {
+            if (count < 1)
+            {
+                throw new Exception("The latency benchmark needs at least one round trip.");
+            }
+
+            var times = new double[count];
+            var watch = new Stopwatch();
+
+            for (int i = 0; i < count; i++)
+            {
+                watch.Restart();
+                TestCommunication();
+                times[i] = watch.Elapsed.TotalMilliseconds;
+            }
+
+            Array.Sort(times);
+            Console.WriteLine($"{count} round trips, min: {times[0]:F3} ms, median: {times[count / 2]:F3} ms, mean: {times.Average():F3} ms, max: {times[count - 1]:F3} ms");
+        }
+
+        /// <summary>
+        /// Checks the compression codec and compares raw and compressed uploads of a file.
+        /// The cartridge checks the CRC of each decompressed chunk
+        /// </summary>
+        /// <param name="filename">The file to upload</param>
+        public static void RunCompressionBenchmark(string filename)
+        {
+            var data = File.ReadAllBytes(filename);
+            Array.Resize(ref data, Math.Min((data.Length + 511) / 512 * 512, MAX_ROM_SIZE));
+
+            Console.Write("Codec round trip...");
+            Lz.SelfTest();
+            var packed = 0L;
+            var time = DateTime.UtcNow.Ticks;
+            for (int offset = 0; offset < data.Length; offset += TRANSFER_CHUNK_SIZE)
+            {
+                packed += Lz.RoundTrip(data, offset, Math.Min(TRANSFER_CHUNK_SIZE, data.Length - offset));
+            }
+            time = DateTime.UtcNow.Ticks - time;
+            Console.WriteLine($"OK. ratio: {packed * 100 / Math.Max(data.Length, 1)}%, speed: {GetSpeedString(data.Length, time)}");
+
+            if ((DeviceCapabilities & Capabilities.Lz) == 0)
+            {
+                Console.WriteLine("The cartridge does not support compressed uploads.");
+                return;
+            }
+
+            var compression = Compression;
+            try
+            {
+                var sent = 0L;
+                var written = 0L;
+                Compression = false;
+                Console.Write("Raw upload...");
+                time = DateTime.UtcNow.Ticks;
+                var chunkTime = RomWriteFramed(data, ROM_BASE_ADDRESS, ref sent, ref written, false);
+                var rawTime = DateTime.UtcNow.Ticks - time;
+                PrintWriteSpeed(chunkTime, sent, written);
+
+                sent = 0;
+                written = 0;
+                Compression = true;
+                Console.Write("Compressed upload...");
+                time = DateTime.UtcNow.Ticks;
+                chunkTime = RomWriteFramed(data, ROM_BASE_ADDRESS, ref sent, ref written, false);
+                var lzTime = DateTime.UtcNow.Ticks - time;
+                PrintWriteSpeed(chunkTime, sent, written);
+
+                Console.WriteLine($"Effective upload speed, raw: {GetSpeedString(data.Length, rawTime)}, compressed: {GetSpeedString(data.Length, lzTime)}");
+            }
+            finally
+            {
+                Compression = compression;
+            }
+        }
+
+        /// <summary>
+        /// Compares the chunk hashes with the ROM memory. The cartridge does not send its hashes if it still has the upload of the hash cache
+        /// </summary>
+        /// <returns>The chunks which are the same on the cartridge</returns>
+        private static bool[] RomHashQuery(uint startAddress, int length, uint[] hashes)
+        {
+            var cache = HashCache.Load();
+            var cachedId = cache != null && cache.Address == startAddress ? cache.TransferId : 0;
+
+            CommandPacketTransmitBytes(TransmitCommand.RomHash, startAddress, (uint)length, cachedId);
+            var responseBytes = CommandPacketReceive();
+            if (responseBytes[4] != 0) return null;
+
+            var count = (int)FromBigEndian(responseBytes, 8);
+            var cartHashes = cachedId != 0 ? cache.Hashes : new uint[0];
+            if (count != 0)
+            {
+                var hashBytes = UsbInterface.Read(count * 4);
+                cartHashes = new uint[count];
+                for (int i = 0; i < count; i++)
+                {
+                    cartHashes[i] = FromBigEndian(hashBytes, i * 4);
+                }
+            }
+
+            var unchanged = new bool[hashes.Length];
+            for (int i = 0; i < Math.Min(hashes.Length, cartHashes.Length); i++)
+            {
+                unchanged[i] = cartHashes[i] == hashes[i];
+            }
+            return unchanged;
+        }
+
+        /// <summary>
+        /// Gets the bitmap of ROM chunks the cartridge received with a good CRC for the transfer
+        /// </summary>
+        private static byte[] TransferQuery(uint transferId)
+        {
+            CommandPacketTransmitBytes(TransmitCommand.TransferQuery, 0, 0, transferId);
+            var responseBytes = CommandPacketReceive();
+            return UsbInterface.Read((int)FromBigEndian(responseBytes, 12));
+        }
+
+        private static bool IsChunkDone(byte[] done, uint startAddress, int chunk)
+        {
+            if (done == null || startAddress % TRANSFER_CHUNK_SIZE != 0) return false; //the cartridge only tracks chunk aligned writes
+
+            var index = (int)((startAddress & (MAX_ROM_SIZE - 1)) / TRANSFER_CHUNK_SIZE) + chunk;
+            var word = index / 32 * 4;
+            var bit = index % 32;
+            if (word >= done.Length) return false;
+
+            return (FromBigEndian(done, word) >> bit & 1) != 0;
+        }
+
+        /// <summary>
+        /// Negotiates the protocol version. Older cartridge software does not reply, and the legacy protocol is used
+        /// </summary>
+        public static void NegotiateProtocol()
+        {
+            ProtocolVersion = 1;
+            DeviceCapabilities = Capabilities.None;
+            transferWindow = TRANSFER_CHUNK_SIZE;
+
+            try
+            {
+                CommandPacketTransmit(TransmitCommand.ProtocolVersion);
+                var responseBytes = CommandPacketReceive();
+                if (responseBytes[5] >= 2)
+                {
+                    ProtocolVersion = responseBytes[5];
+                    DeviceCapabilities = (Capabilities)FromBigEndian(responseBytes, 8);
+                    transferWindow = (int)Math.Min(FromBigEndian(responseBytes, 12), 64 * TRANSFER_CHUNK_SIZE); //the CRC table has room for 128 chunks, 64 fit the reply mask
+                }
+            }
+            catch (TimeoutException) { }
+        }
+
         /// <summary>
         /// Starts a ROM on the cartridge
         /// </summary>
@@ -311,7 +796,7 @@ namespace ed64usb
 
         private static void FillCartridgeRomSpace(int romLength, uint value)
         {
-            var crcArea = 0x100000 + 4096;
+            var crcArea = CRC_AREA_SIZE;
             if (romLength < crcArea)
             {
                 Console.WriteLine();
@@ -356,6 +841,14 @@ namespace ed64usb
         {
             length /= 512; //Must take into account buffer size.
 
+            CommandPacketTransmitBytes(commandType, address, (uint)length, argument);
+        }
+
+        /// <summary>
+        /// Transmits a command with the length field as is (in bytes for the framed commands)
+        /// </summary>
+        private static void CommandPacketTransmitBytes(TransmitCommand commandType, uint address, uint length, uint argument)
+        {
             var commandPacket = new List<byte>();
 
             commandPacket.AddRange(Encoding.ASCII.GetBytes("cmd"));
@@ -377,6 +870,51 @@ namespace ed64usb
 
         }
 
+        /// <summary>
+        /// Shows the debug log of the program on the console until a key is pressed
+        /// </summary>
+        public static void LogView()
+        {
+            Console.WriteLine("Debug log, press any key to stop.");
+
+            while (Console.IsInputRedirected || !Console.KeyAvailable)
+            {
+                byte[] header;
+                try
+                {
+                    header = UsbInterface.Read(16);
+                }
+                catch (TimeoutException)
+                {
+                    continue; //nothing logged
+                }
+
+                if (Encoding.ASCII.GetString(header, 0, 4) == "cmdl")
+                {
+                    LogFrameReceive(header);
+                }
+            }
+            Console.ReadKey(true);
+        }
+
+        /// <summary>
+        /// Reads the text of a log frame and writes it to the console
+        /// </summary>
+        /// <param name="header">The 16 byte header of the frame</param>
+        private static void LogFrameReceive(byte[] header)
+        {
+            var length = (int)FromBigEndian(header, 8);
+            var dropped = FromBigEndian(header, 12);
+            var text = UsbInterface.Read((length + 3) & ~3);
+
+            if (dropped != logDropped)
+            {
+                Console.WriteLine($"[{dropped - logDropped} bytes of log dropped]");
+                logDropped = dropped;
+            }
+            Console.Write(Encoding.ASCII.GetString(text, 0, length));
+        }
+
         /// <summary>
         /// Receives a command response from the USB port
         /// </summary>
@@ -385,6 +923,11 @@ namespace ed64usb
         {
 
             var cmd = UsbInterface.Read(16);
+            while (Encoding.ASCII.GetString(cmd, 0, 4) == "cmdl")
+            {
+                LogFrameReceive(cmd);
+                cmd = UsbInterface.Read(16);
+            }
             if (Encoding.ASCII.GetString(cmd).ToLower().StartsWith("cmd") || Encoding.ASCII.GetString(cmd).ToLower().StartsWith("RSP"))
             {
                 switch ((ReceiveCommand)cmd[3])
@@ -405,6 +948,18 @@ namespace ed64usb
 
 
 
+        private static byte[] ToBigEndian(uint value)
+        {
+            var bytes = BitConverter.GetBytes(value);
+            if (BitConverter.IsLittleEndian) Array.Reverse(bytes);
+            return bytes;
+        }
+
+        private static uint FromBigEndian(byte[] data, int offset)
+        {
+            return (uint)(data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3]);
+        }
+
         private static string GetSpeedString(long length, long time)
         {
             time /= 10000;
@@ -0,0 +1,42 @@
+﻿namespace ed64usb
+{
+    /// <summary>
+    /// CRC-32 (reflected 0xEDB88320), the same as the one used by the cartridge for framed transfers
+    /// </summary>
+    public static class Crc32
+    {
+        private static readonly uint[] table = CreateTable();
+
+        private static uint[] CreateTable()
+        {
+            var tab = new uint[256];
+            for (uint i = 0; i < tab.Length; i++)
+            {
+                var value = i;
+                for (int u = 0; u < 8; u++)
+                {
+                    value = (value & 1) != 0 ? (value >> 1) ^ 0xEDB88320 : value >> 1;
+                }
+                tab[i] = value;
+            }
+            return tab;
+        }
+
+        /// <summary>
+        /// Calculates the CRC of part of a buffer
+        /// </summary>
+        /// <param name="data">The data</param>
+        /// <param name="offset">The start offset</param>
+        /// <param name="length">The length</param>
+        /// <returns>The CRC</returns>
+        public static uint Compute(byte[] data, int offset, int length)
+        {
+            var crc = 0xFFFFFFFF;
+            for (int i = offset; i < offset + length; i++)
+            {
+                crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return crc ^ 0xFFFFFFFF;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+﻿using System;
+using System.IO;
+
+namespace ed64usb
+{
+    /// <summary>
+    /// Chunk hashes of the last ROM upload. The cartridge confirms that its memory still holds that upload, so the hashes do not have to be read back
+    /// </summary>
+    public class HashCache
+    {
+        private const uint MAGIC = 0x55363448; //"U64H"
+        private static readonly string cachePath = Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "usb64", "rom-hashes.bin");
+
+        public uint TransferId { get; set; }
+        public uint Address { get; set; }
+        public uint[] Hashes { get; set; }
+
+        /// <summary>
+        /// FNV-1a over the big endian words of each chunk, the same as the cartridge
+        /// </summary>
+        /// <param name="data">The data</param>
+        /// <param name="chunkSize">The chunk size</param>
+        /// <returns>The hash of each chunk</returns>
+        public static uint[] Compute(byte[] data, int chunkSize)
+        {
+            var hashes = new uint[(data.Length + chunkSize - 1) / chunkSize];
+            for (int i = 0; i < hashes.Length; i++)
+            {
+                var hash = 0x811C9DC5;
+                var end = Math.Min(data.Length, (i + 1) * chunkSize);
+                for (int u = i * chunkSize; u + 3 < end; u += 4)
+                {
+                    hash = (hash ^ (uint)(data[u] << 24 | data[u + 1] << 16 | data[u + 2] << 8 | data[u + 3])) * 0x01000193;
+                }
+                hashes[i] = hash;
+            }
+            return hashes;
+        }
+
+        /// <summary>
+        /// Loads the cache
+        /// </summary>
+        /// <returns>The cache, null if there is none</returns>
+        public static HashCache Load()
+        {
+            try
+            {
+                using (var br = new BinaryReader(File.OpenRead(cachePath)))
+                {
+                    if (br.ReadUInt32() != MAGIC) return null;
+
+                    var cache = new HashCache
+                    {
+                        TransferId = br.ReadUInt32(),
+                        Address = br.ReadUInt32(),
+                        Hashes = new uint[br.ReadInt32()]
+                    };
+                    for (int i = 0; i < cache.Hashes.Length; i++)
+                    {
+                        cache.Hashes[i] = br.ReadUInt32();
+                    }
+                    return cache;
+                }
+            }
+            catch (Exception) //no cache or a broken one, the hashes are read from the cartridge
+            {
+                return null;
+            }
+        }
+
+        /// <summary>
+        /// Saves the cache. Failing to save it only costs a hash query on the next upload
+        /// </summary>
+        public void Save()
+        {
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(cachePath));
+                using (var bw = new BinaryWriter(File.Create(cachePath)))
+                {
+                    bw.Write(MAGIC);
+                    bw.Write(TransferId);
+                    bw.Write(Address);
+                    bw.Write(Hashes.Length);
+                    foreach (var hash in Hashes)
+                    {
+                        bw.Write(hash);
+                    }
+                }
+            }
+            catch (Exception) { }
+        }
+    }
+}
@@ -0,0 +1,210 @@
+﻿using System;
+using System.IO;
+
+namespace ed64usb
+{
+    /// <summary>
+    /// LZ4 block format codec for compressed ROM uploads. Each 64K chunk is an independent block, the cartridge decodes it straight to ROM
+    /// </summary>
+    public static class Lz
+    {
+        private const int MIN_MATCH = 4;
+        private const int LAST_LITERALS = 5; //the format requires the last bytes to be literals
+        private const int MATCH_FIND_LIMIT = 12;
+        private const int MAX_OFFSET = 0xFFFF;
+        private const int HASH_BITS = 14;
+
+        /// <summary>
+        /// Compresses part of a buffer
+        /// </summary>
+        /// <param name="src">The data</param>
+        /// <param name="offset">The start offset</param>
+        /// <param name="length">The length</param>
+        /// <returns>The LZ4 block</returns>
+        public static byte[] Compress(byte[] src, int offset, int length)
+        {
+            var dst = new byte[length + length / 255 + 16];
+            var table = new int[1 << HASH_BITS]; //last position of each hash, +1 so that 0 is empty
+            var end = offset + length;
+            var matchLimit = end - LAST_LITERALS;
+            var findLimit = end - MATCH_FIND_LIMIT;
+            var anchor = offset;
+            var ip = offset;
+            var op = 0;
+
+            while (ip < findLimit)
+            {
+                var sequence = ReadInt(src, ip);
+                var hash = (int)((uint)sequence * 2654435761u >> (32 - HASH_BITS));
+                var match = table[hash] - 1;
+                table[hash] = ip + 1;
+
+                if (match < 0 || ip - match > MAX_OFFSET || ReadInt(src, match) != sequence)
+                {
+                    ip += 1 + ((ip - anchor) >> 6); //skip faster through data that does not compress
+                    continue;
+                }
+
+                while (ip > anchor && match > offset && src[ip - 1] == src[match - 1])
+                {
+                    ip--;
+                    match--;
+                }
+
+                var matchLength = MIN_MATCH;
+                while (ip + matchLength < matchLimit && src[ip + matchLength] == src[match + matchLength]) matchLength++;
+
+                op = WriteSequence(dst, op, src, anchor, ip - anchor, ip - match, matchLength);
+                ip += matchLength;
+                anchor = ip;
+            }
+
+            op = WriteSequence(dst, op, src, anchor, end - anchor, 0, 0);
+            Array.Resize(ref dst, op);
+            return dst;
+        }
+
+        /// <summary>
+        /// Decompresses a block, the same way as the cartridge
+        /// </summary>
+        /// <param name="src">The LZ4 block</param>
+        /// <param name="dst">The output buffer</param>
+        /// <param name="dstOffset">The output offset</param>
+        /// <param name="length">The decompressed length</param>
+        public static void Decompress(byte[] src, byte[] dst, int dstOffset, int length)
+        {
+            var ip = 0;
+            var op = dstOffset;
+            var end = dstOffset + length;
+
+            while (ip < src.Length)
+            {
+                var token = src[ip++];
+                var count = ReadLength(src, ref ip, token >> 4);
+                if (ip + count > src.Length || op + count > end) throw new InvalidDataException("LZ4 literals out of range.");
+                Array.Copy(src, ip, dst, op, count);
+                ip += count;
+                op += count;
+                if (ip == src.Length) break;
+
+                if (ip + 2 > src.Length) throw new InvalidDataException("LZ4 block is truncated.");
+                var matchOffset = src[ip] | src[ip + 1] << 8;
+                ip += 2;
+                count = ReadLength(src, ref ip, token & 15) + MIN_MATCH;
+                if (matchOffset == 0 || matchOffset > op - dstOffset || op + count > end) throw new InvalidDataException("LZ4 match out of range.");
+                for (int i = 0; i < count; i++, op++)
+                {
+                    dst[op] = dst[op - matchOffset];
+                }
+            }
+
+            if (op != end) throw new InvalidDataException("LZ4 block has the wrong length.");
+        }
+
+        /// <summary>
+        /// Round trip of generated data which covers the corner cases of the format
+        /// </summary>
+        public static void SelfTest()
+        {
+            var random = new Random(64);
+            var noise = new byte[0x10000];
+            random.NextBytes(noise);
+
+            var cases = new[]
+            {
+                new byte[0],
+                new byte[] { 1 },
+                new byte[13],
+                new byte[0x10000],
+                noise,
+                Generate(0x10000, i => (byte)(i % 3)), //overlapping matches
+                Generate(0x10000, i => (byte)(i / 300)), //long literal and match lengths
+                Generate(0x10000, i => noise[i % 0x1234]), //matches at a large distance
+                Generate(0x10000, i => random.Next(4) == 0 ? noise[i] : (byte)(i >> 4)), //short matches
+                Generate(0x8200, i => noise[i & 0xFF]), //not a multiple of the chunk size
+            };
+
+            foreach (var data in cases)
+            {
+                RoundTrip(data, 0, data.Length);
+            }
+        }
+
+        /// <summary>
+        /// Compresses and decompresses part of a buffer, throws if the data does not match
+        /// </summary>
+        /// <returns>The compressed length</returns>
+        public static int RoundTrip(byte[] data, int offset, int length)
+        {
+            var packed = Compress(data, offset, length);
+            var unpacked = new byte[length];
+            Decompress(packed, unpacked, 0, length);
+
+            for (int i = 0; i < length; i++)
+            {
+                if (unpacked[i] != data[offset + i]) throw new Exception($"LZ4 round trip error at byte 0x{offset + i:X}");
+            }
+
+            return packed.Length;
+        }
+
+        private static byte[] Generate(int length, Func<int, byte> value)
+        {
+            var data = new byte[length];
+            for (int i = 0; i < length; i++)
+            {
+                data[i] = value(i);
+            }
+            return data;
+        }
+
+        private static int ReadInt(byte[] data, int offset)
+        {
+            return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | data[offset + 3] << 24;
+        }
+
+        private static int ReadLength(byte[] src, ref int ip, int length)
+        {
+            if (length != 15) return length;
+
+            byte value;
+            do
+            {
+                if (ip >= src.Length) throw new InvalidDataException("LZ4 block is truncated.");
+                value = src[ip++];
+                length += value;
+            } while (value == 255);
+
+            return length;
+        }
+
+        private static int WriteSequence(byte[] dst, int op, byte[] src, int literals, int literalLength, int matchOffset, int matchLength)
+        {
+            var token = op++;
+            dst[token] = (byte)(Math.Min(literalLength, 15) << 4);
+            if (literalLength >= 15) op = WriteLength(dst, op, literalLength - 15);
+            Array.Copy(src, literals, dst, op, literalLength);
+            op += literalLength;
+
+            if (matchLength == 0) return op; //last literals, end of the block
+
+            dst[op++] = (byte)matchOffset;
+            dst[op++] = (byte)(matchOffset >> 8);
+            matchLength -= MIN_MATCH;
+            dst[token] |= (byte)Math.Min(matchLength, 15);
+            if (matchLength >= 15) op = WriteLength(dst, op, matchLength - 15);
+
+            return op;
+        }
+
+        private static int WriteLength(byte[] dst, int op, int length)
+        {
+            for (; length >= 255; length -= 255)
+            {
+                dst[op++] = 255;
+            }
+            dst[op++] = (byte)length;
+            return op;
+        }
+    }
+}
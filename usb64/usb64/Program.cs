@@ -34,7 +34,15 @@ namespace ed64usb
             Console.WriteLine("-start[=<ROM filename>] (Used for ROM save file. Only required when different from '-rom=<filename>').");
             Console.WriteLine("-diag (Runs communications diagnostics.");
             Console.WriteLine("-drom=<filename> (Dumps loaded ROM to PC).");
+            Console.WriteLine("-lzbench=<filename> (Checks the upload compression and compares raw and compressed upload speed).");
+            Console.WriteLine("-latency[=<count>] (Measures the round trip time of commands, 1000 by default).");
+            Console.WriteLine("-nolz (Uploads ROMs without compression).");
+            Console.WriteLine("-nodelta (Uploads the whole ROM, even the parts which are already on the cartridge).");
             Console.WriteLine("-screen=<filename> (Dumps framebuffer as BMP to PC).");
+            Console.WriteLine("-ramwrite=<filename>@<address> (Writes data to RAM of the running program, e.g. 0x80200000).");
+            Console.WriteLine("-patch=<filename>@<address> (Writes code to RAM of the running program and invalidates the instruction cache).");
+            Console.WriteLine("-sdwrite=<filename>@<SD card path> (Uploads a file to the SD card, e.g. -sdwrite=game.z64@ED64/game.z64).");
+            Console.WriteLine("-log (Shows the debug log of the running program until a key is pressed).");
             //Console.WriteLine("-unfdebug (Runs the unf Debugger).");
             Console.WriteLine("-save=<savetype> (Runs the ROM with a save type when not matched in the internal database)");
             Console.WriteLine("      Options: [None,Eeprom4k,Eeprom16k,Sram,Sram768k,FlashRam,Sram128k].");
@@ -111,6 +119,7 @@ namespace ed64usb
                 var forceRom = false;
                 var loadRom = false;
                 var startRom = false;
+                var showLog = false;
                 //var unfDebug = false;
 
                 var time = DateTime.UtcNow.Ticks;
@@ -167,6 +176,21 @@ namespace ed64usb
                             startRom = true; //args could be in any order... wait until we have handled all arguments first.
                             break;
 
+                        case string x when x.StartsWith("-sdwrite"):
+                            var upload = ExtractSubArg(arg);
+                            var separator = upload.LastIndexOf('@');
+                            if (separator < 0)
+                            {
+                                throw new Exception($"The {arg} argument needs an SD card path!");
+                            }
+                            Console.Write($"Uploading to SD card {upload.Substring(separator + 1)}...");
+                            CommandProcessor.FileWrite(upload.Substring(0, separator), upload.Substring(separator + 1));
+                            break;
+
+                        case string x when x.StartsWith("-log"):
+                            showLog = true; //after the ROM is started
+                            break;
+
                         case string x when x.StartsWith("-diag"):
                             Console.WriteLine("Performing USB diagnostics...");
                             CommandProcessor.RunDiagnostics();
@@ -175,11 +199,41 @@ namespace ed64usb
                             Console.ResetColor();
                             break;
 
+                        case string x when x.StartsWith("-lzbench"):
+                            Console.WriteLine("Benchmarking upload compression.");
+                            CommandProcessor.RunCompressionBenchmark(ExtractSubArg(arg));
+                            break;
+
+                        case string x when x.StartsWith("-latency"):
+                            Console.WriteLine("Benchmarking command latency.");
+                            CommandProcessor.RunLatencyBenchmark(arg.Contains('=') ? int.Parse(ExtractSubArg(arg)) : 1000);
+                            break;
+
+                        case string x when x.StartsWith("-nolz"):
+                            CommandProcessor.Compression = false;
+                            break;
+
+                        case string x when x.StartsWith("-nodelta"):
+                            CommandProcessor.Delta = false;
+                            break;
+
                         case string x when x.StartsWith("-drom"):
                             Console.Write("Reading ROM...");
                             CommandProcessor.DumpRom(ExtractSubArg(arg));
                             break;
 
+                        case string x when x.StartsWith("-ramwrite"):
+                        case string y when y.StartsWith("-patch"):
+                            var target = ExtractSubArg(arg);
+                            var at = target.LastIndexOf('@');
+                            if (at < 0)
+                            {
+                                throw new Exception($"The {arg} argument needs an address!");
+                            }
+                            Console.Write($"Writing RAM at {target.Substring(at + 1)}...");
+                            CommandProcessor.RamWrite(File.ReadAllBytes(target.Substring(0, at)), Convert.ToUInt32(target.Substring(at + 1), 16), arg.StartsWith("-patch"));
+                            break;
+
                         case string x when x.StartsWith("-screen"):
                             Console.WriteLine("Reading Framebuffer.");
                             CommandProcessor.DumpScreenBuffer(ExtractSubArg(arg));
@@ -227,6 +281,11 @@ namespace ed64usb
                 time = (DateTime.UtcNow.Ticks - time) / 10000;
                 Console.WriteLine("Finished in: {0:D}.{1:D3} seconds.", time / 1000, time % 1000);
 
+                if (showLog)
+                {
+                    CommandProcessor.LogView();
+                }
+
                 // if (unfDebug)
                 // {
                 //     Console.Write("Starting unf debug session, ");
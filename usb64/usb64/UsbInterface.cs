@@ -37,7 +37,7 @@ namespace ed64usb
 
         }
 
-        private static void Write(byte[] data, int offset, int length)
+        public static void Write(byte[] data, int offset, int length)
         {
 
             while (length > 0)
@@ -97,9 +97,10 @@ namespace ed64usb
                     port.ReadTimeout = 200;
                     port.WriteTimeout = 200;
                     CommandProcessor.TestCommunication();
+                    CommandProcessor.NegotiateProtocol();
                     port.ReadTimeout = 2000;
                     port.WriteTimeout = 2000;
-                    Console.WriteLine($"Everdrive64 X-series found on serialport {p}");
+                    Console.WriteLine($"Everdrive64 X-series found on serialport {p}, protocol v{CommandProcessor.ProtocolVersion}");
                     return;
                 }
                 catch (Exception) { }